@@ -15,18 +15,106 @@
  * Date: 24 September 2025
  */
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <iostream>
 #include <iomanip>
+#include <charconv>
+#include <condition_variable>
+#include <fstream>
+#include <functional>
 #include <limits>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
 #include <cmath>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define GRAB_FARE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+// Fare arithmetic is evaluated exactly as written.  GCC's C++ default is
+// -ffp-contract=fast, which fuses a * b + c into one FMA (rounded once)
+// wherever the target has FMA: always inside AVX-512 code, and everywhere
+// under -march=native.  Every function that prices a trip carries this so
+// the scalar and vector paths agree bit for bit on any build; GCC will not
+// inline them into callers without it, so those make an ordinary call.
+#define GRAB_FARE_EXACT_FP __attribute__((optimize("fp-contract=off")))
 
 using std::cin;
 using std::cout;
 using std::endl;
 using std::string;
 
+// Heap allocations made by this thread while tCountAllocations is set.  The
+// benchmark suite sets it around each timed run to report allocs/op; every
+// other allocation pays one test of a thread-local flag and touches no
+// shared state.  Every form that can hand memory to these deletes is
+// replaced; the array forms forward to them.
+static thread_local bool tCountAllocations = false;
+static thread_local uint64_t tAllocationCount = 0;
+
+// GCC flags free() on memory it cannot see came from this operator new
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void *operator new(std::size_t size) {
+    if (tCountAllocations) ++tAllocationCount;
+    if (void *p = std::malloc(size != 0 ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+void *operator new(std::size_t size, std::align_val_t align) {
+    if (tCountAllocations) ++tAllocationCount;
+    size_t alignment = std::max(static_cast<size_t>(align), sizeof(void *));
+    size_t rounded = (std::max<size_t>(size, 1) + alignment - 1) / alignment * alignment;
+    if (void *p = std::aligned_alloc(alignment, rounded)) return p;
+    throw std::bad_alloc();
+}
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+    if (tCountAllocations) ++tAllocationCount;
+    return std::malloc(size != 0 ? size : 1);
+}
+void *operator new(std::size_t size, std::align_val_t align, const std::nothrow_t &) noexcept {
+    try {
+        return ::operator new(size, align);
+    } catch (const std::bad_alloc &) {
+        return nullptr;
+    }
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+#pragma GCC diagnostic pop
+
 // Structure to hold pricing for a vehicle type
 struct Rates {
     double base;         // Base fare (RM)
@@ -35,13 +123,35 @@ struct Rates {
     double bookingFee;   // Fixed booking fee (RM)
 };
 
+// Vehicle classes offered by the calculator; ids match the menu choices
+enum class Vehicle : uint8_t { Economy = 1, Premium = 2, Bike = 3 };
+
+// Compile-time facts about each vehicle class.  A class that is not time
+// metered must have perMin == 0 in its rates, and its specialised pricing
+// path drops the time term entirely.
+template <Vehicle V> struct VehicleClass;
+template <> struct VehicleClass<Vehicle::Economy> { static constexpr bool timeMetered = true; };
+template <> struct VehicleClass<Vehicle::Premium> { static constexpr bool timeMetered = true; };
+template <> struct VehicleClass<Vehicle::Bike> { static constexpr bool timeMetered = false; };
+
+// Runtime view of VehicleClass<V>::timeMetered; ids outside the enum are
+// treated as time metered (the generic path)
+constexpr bool isTimeMetered(int vehicleId) {
+    return vehicleId == static_cast<int>(Vehicle::Economy) ? VehicleClass<Vehicle::Economy>::timeMetered
+         : vehicleId == static_cast<int>(Vehicle::Premium) ? VehicleClass<Vehicle::Premium>::timeMetered
+         : vehicleId == static_cast<int>(Vehicle::Bike) ? VehicleClass<Vehicle::Bike>::timeMetered
+         : true;
+}
+
 // Structure to hold promo code information
 struct Promo {
     double percentage;   // Percentage discount (0–1)
     double cap;          // Maximum discount amount (RM)
 };
 
-// Structure to hold a full fare breakdown
+// Structure to hold a full fare breakdown.  The promo is stored as its id
+// in the PromoTable and only turned into a code when printed, so the struct
+// is trivially copyable and can be memcpy'd into arrays, rings and files.
 struct FareBreakdown {
     double base;
     double booking;
@@ -50,22 +160,13 @@ struct FareBreakdown {
     double peakMultiplier;      // 1.0 or a value > 1 during peak times
     double distanceCostFinal;
     double subtotal;
-    string promoCode;
+    uint16_t promoId;           // 0 = NONE; see PromoTable::code()
     double discountApplied;
     double totalBeforeMin;
     double totalPayable;
 };
-
-// Convert a string to uppercase and trim whitespace
-static string toUpperTrim(const string &s) {
-    size_t start = s.find_first_not_of(" \t\r\n");
-    size_t end = s.find_last_not_of(" \t\r\n");
-    string trimmed = (start == string::npos) ? "" : s.substr(start, end - start + 1);
-    for (auto &c : trimmed) {
-        c = static_cast<char>(toupper(static_cast<unsigned char>(c)));
-    }
-    return trimmed;
-}
+static_assert(std::is_trivially_copyable<FareBreakdown>::value,
+              "FareBreakdown must stay trivially copyable");
 
 // Read a double with validation; returns false if input fails (EOF)
 bool readPositiveDouble(const string &prompt, double &out, double maxVal = std::numeric_limits<double>::max()) {
@@ -101,160 +202,6232 @@ int readMenuChoice(const string &prompt, int lo, int hi) {
     }
 }
 
-// Compute the fare breakdown based on input parameters
-FareBreakdown computeFare(double distanceKm, double timeMin, bool isPeak,
-                          const string &promoCodeRaw, const Rates &rates,
-                          double peakMultiplier, double minFare,
-                          const std::map<string, Promo> &promoMap) {
+// The arithmetic half of priceTrip(): every field at full precision.  With
+// TimeMetered false the time term is compiled out; that is only valid for
+// rates with perMin == 0.
+template <bool TimeMetered = true>
+GRAB_FARE_EXACT_FP
+static inline FareBreakdown priceTripUnrounded(double distanceKm, double timeMin, bool isPeak,
+                                               const Rates &rates, uint16_t promoId, const Promo &promo,
+                                               double peakMultiplier, double minFare) {
     FareBreakdown fb{};
     fb.base = rates.base;
     fb.booking = rates.bookingFee;
     fb.distanceCostOffPeak = distanceKm * rates.perKm;
-    fb.timeCost = timeMin * rates.perMin;
     fb.peakMultiplier = isPeak ? peakMultiplier : 1.0;
     fb.distanceCostFinal = fb.distanceCostOffPeak * fb.peakMultiplier;
-    fb.subtotal = fb.base + fb.booking + fb.distanceCostFinal + fb.timeCost;
+    if constexpr (TimeMetered) {
+        fb.timeCost = timeMin * rates.perMin;
+        fb.subtotal = fb.base + fb.booking + fb.distanceCostFinal + fb.timeCost;
+    } else {
+        (void)timeMin;
+        fb.subtotal = fb.base + fb.booking + fb.distanceCostFinal;
+    }
 
-    // Determine promo code discount
-    string code = toUpperTrim(promoCodeRaw);
-    fb.promoCode = promoMap.count(code) ? code : "NONE";
-    Promo promo = promoMap.at(fb.promoCode);
+    fb.promoId = promoId;
     double rawDiscount = fb.subtotal * promo.percentage;
     fb.discountApplied = (rawDiscount > promo.cap) ? promo.cap : rawDiscount;
 
     fb.totalBeforeMin = fb.subtotal - fb.discountApplied;
     fb.totalPayable = (fb.totalBeforeMin < minFare) ? minFare : fb.totalBeforeMin;
+    return fb;
+}
 
-    // Round values to two decimal places
+// The rounding half of priceTrip(): money fields to two decimal places
+template <bool TimeMetered = true>
+GRAB_FARE_EXACT_FP
+static inline void roundBreakdown(FareBreakdown &fb) {
     auto round2 = [](double v) { return std::round(v * 100.0) / 100.0; };
     fb.base = round2(fb.base);
     fb.booking = round2(fb.booking);
     fb.distanceCostOffPeak = round2(fb.distanceCostOffPeak);
-    fb.timeCost = round2(fb.timeCost);
+    if constexpr (TimeMetered) fb.timeCost = round2(fb.timeCost);
     fb.distanceCostFinal = round2(fb.distanceCostFinal);
     fb.subtotal = round2(fb.subtotal);
     fb.discountApplied = round2(fb.discountApplied);
     fb.totalBeforeMin = round2(fb.totalBeforeMin);
     fb.totalPayable = round2(fb.totalPayable);
+}
+
+// Price one trip once the vehicle rates and promo have been resolved.  The
+// single-trip and batch paths both come through here, so they produce
+// exactly the same numbers.  With TimeMetered false the time term is
+// compiled out; that is only valid for rates with perMin == 0, and gives the
+// same result as the generic path for them.
+template <bool TimeMetered = true>
+GRAB_FARE_EXACT_FP
+static inline FareBreakdown priceTrip(double distanceKm, double timeMin, bool isPeak,
+                                      const Rates &rates, uint16_t promoId, const Promo &promo,
+                                      double peakMultiplier, double minFare) {
+    FareBreakdown fb = priceTripUnrounded<TimeMetered>(distanceKm, timeMin, isPeak, rates, promoId, promo,
+                                                       peakMultiplier, minFare);
+    roundBreakdown<TimeMetered>(fb);
     return fb;
 }
 
-// Print the fare breakdown in a user-friendly format
-void printBreakdown(const FareBreakdown &fb) {
-    cout << std::fixed << std::setprecision(2);
-    cout << "\n--- Fare Breakdown (RM) ---" << endl;
-    cout << "Base fare              : " << fb.base << endl;
-    cout << "Booking fee            : " << fb.booking << endl;
-    cout << "Distance cost (off-peak): " << fb.distanceCostOffPeak << endl;
-    if (fb.peakMultiplier > 1.0) {
-        cout << "Peak multiplier x" << fb.peakMultiplier << " applied to distance" << endl;
-    } else {
-        cout << "Peak multiplier        : x1.00 (off-peak)" << endl;
+// Strip leading and trailing whitespace from a view without copying
+static std::string_view trimView(std::string_view s) {
+    size_t start = s.find_first_not_of(" \t\r\n");
+    if (start == std::string_view::npos) return {};
+    size_t end = s.find_last_not_of(" \t\r\n");
+    return s.substr(start, end - start + 1);
+}
+
+// Promo codes are matched on a fixed-width key: the code trimmed, upper-cased
+// and NUL-padded to 16 bytes
+constexpr size_t kPromoKeyWidth = 16;
+
+struct PromoKey {
+    uint64_t lo;
+    uint64_t hi;
+    bool operator==(const PromoKey &o) const { return lo == o.lo && hi == o.hi; }
+};
+
+// Fold a raw code into its key without allocating.  Returns false if the
+// trimmed code is longer than the key width, since it cannot match.
+static inline bool foldPromoKey(std::string_view raw, PromoKey &key) {
+    std::string_view code = trimView(raw);
+    if (code.size() > kPromoKeyWidth) return false;
+    unsigned char bytes[kPromoKeyWidth] = {};
+    for (size_t i = 0; i < code.size(); ++i) {
+        unsigned char c = static_cast<unsigned char>(code[i]);
+        bytes[i] = (c >= 'a' && c <= 'z') ? static_cast<unsigned char>(c - ('a' - 'A')) : c;
     }
-    cout << "Distance cost (final)  : " << fb.distanceCostFinal << endl;
-    if (fb.timeCost > 0) {
-        cout << "Time cost              : " << fb.timeCost << endl;
+    std::memcpy(&key.lo, bytes, 8);
+    std::memcpy(&key.hi, bytes + 8, 8);
+    return true;
+}
+
+static inline uint64_t mix64(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    return x;
+}
+
+// Promo codes and discounts addressed by small integer id (0 is always
+// "NONE"), with a perfect hash from folded code to id.
+//
+// The hash is built at load time by hash-and-displace: keys are grouped into
+// buckets by their hash, and each bucket gets a displacement chosen so that
+// all keys land in distinct slots.  A lookup folds the code on the stack,
+// reads its bucket's displacement and compares one slot, so it is O(1), a
+// single probe and allocation-free.  Empty slots hold the all-zero key with
+// id 0, which is also what an empty code folds to.
+class PromoTable {
+public:
+    PromoTable() = default;
+
+    // Throws std::invalid_argument for codes that are empty, longer than 16
+    // bytes or duplicates once case-folded
+    explicit PromoTable(const std::map<string, Promo> &promoMap) {
+        auto add = [this](const string &code, const Promo &promo) {
+            PromoKey key;
+            if (trimView(code).empty() || !foldPromoKey(code, key)) {
+                throw std::invalid_argument("promo code must be 1-16 characters: '" + code + "'");
+            }
+            for (const PromoKey &k : keys_) {
+                if (k == key) throw std::invalid_argument("duplicate promo code: " + code);
+            }
+            string folded(trimView(code));
+            for (auto &c : folded) c = static_cast<char>(toupper(static_cast<unsigned char>(c)));
+            keys_.push_back(key);
+            codes_.push_back(folded);
+            promos_.push_back(promo);
+        };
+        add("NONE", promoMap.count("NONE") ? promoMap.at("NONE") : Promo{0.0, 0.0});
+        for (const auto &entry : promoMap) {
+            if (entry.first != "NONE") add(entry.first, entry.second);
+        }
+        if (promos_.size() > std::numeric_limits<uint16_t>::max()) {
+            throw std::invalid_argument("too many promo codes");
+        }
+        buildIndex();
+    }
+
+    // One slot of the hash index
+    struct Slot {
+        PromoKey key;
+        uint16_t id;
+    };
+
+    // Adopt an index built earlier by this class, as stored in a compiled
+    // rate card.  Throws std::invalid_argument unless the index is
+    // well-formed and every code finds its own id.
+    PromoTable(std::vector<Promo> promos, std::vector<PromoKey> keys, std::vector<Slot> slots,
+               std::vector<uint16_t> displacement)
+        : promos_(std::move(promos)), keys_(std::move(keys)), slots_(std::move(slots)),
+          displacement_(std::move(displacement)) {
+        auto powerOfTwo = [](size_t n) { return n != 0 && (n & (n - 1)) == 0; };
+        PromoKey none{0, 0};
+        foldPromoKey("NONE", none);
+        if (keys_.size() != promos_.size() || keys_.empty() || !(keys_[0] == none) ||
+            keys_.size() > std::numeric_limits<uint16_t>::max() || !powerOfTwo(slots_.size()) ||
+            !powerOfTwo(displacement_.size())) {
+            throw std::invalid_argument("malformed promo index");
+        }
+        bucketMask_ = displacement_.size() - 1;
+        slotMask_ = slots_.size() - 1;
+        for (const Slot &slot : slots_) {
+            bool empty = slot.key == PromoKey{0, 0} && slot.id == 0;
+            if (!empty && (slot.id >= keys_.size() || !(keys_[slot.id] == slot.key))) {
+                throw std::invalid_argument("promo index slot holds an unknown code");
+            }
+        }
+        codes_.reserve(keys_.size());
+        for (size_t id = 0; id < keys_.size(); ++id) {
+            if (find(keys_[id]) != id) throw std::invalid_argument("promo index does not match its codes");
+            char bytes[kPromoKeyWidth];
+            std::memcpy(bytes, &keys_[id].lo, 8);
+            std::memcpy(bytes + 8, &keys_[id].hi, 8);
+            codes_.emplace_back(bytes, strnlen(bytes, kPromoKeyWidth));
+        }
+    }
+
+    // Id of a raw code, ignoring case and surrounding whitespace; unknown
+    // codes resolve to NONE (0)
+    uint16_t find(std::string_view raw) const {
+        PromoKey key;
+        if (!foldPromoKey(raw, key)) return 0;
+        return find(key);
+    }
+
+    // Id of an already folded key; unknown keys resolve to NONE (0)
+    uint16_t find(const PromoKey &key) const {
+        uint64_t h = hashKey(key);
+        const Slot &slot = slots_[slotOf(h, displacement_[h & bucketMask_])];
+        return slot.key == key ? slot.id : 0;
+    }
+
+    size_t size() const { return promos_.size(); }
+    const Promo &operator[](size_t id) const { return promos_[id]; }
+    const string &code(size_t id) const { return codes_[id]; }
+    const std::vector<string> &codes() const { return codes_; }
+
+    // The index itself, for writing compiled rate cards
+    const std::vector<PromoKey> &keys() const { return keys_; }
+    const std::vector<Slot> &slots() const { return slots_; }
+    const std::vector<uint16_t> &displacements() const { return displacement_; }
+
+private:
+    static uint64_t hashKey(const PromoKey &key) { return mix64(key.lo ^ mix64(key.hi + 0x9E3779B97F4A7C15ULL)); }
+    uint64_t slotOf(uint64_t h, uint16_t displacement) const {
+        return mix64(h + displacement * 0x9E3779B97F4A7C15ULL) & slotMask_;
+    }
+
+    void buildIndex() {
+        size_t n = keys_.size();
+        size_t bucketCount = 1, slotCount = 8;
+        while (bucketCount * 2 < n) bucketCount *= 2;
+        while (slotCount < 2 * n) slotCount *= 2;
+        while (!tryBuild(bucketCount, slotCount)) slotCount *= 2;
     }
-    cout << "Subtotal               : " << fb.subtotal << endl;
-    cout << "Promo code used        : " << fb.promoCode;
-    if (fb.promoCode != "NONE") {
-        cout << " (discount " << fb.discountApplied << ")";
+
+    // Place every bucket, largest first; false if some bucket found no
+    // displacement that fits
+    bool tryBuild(size_t bucketCount, size_t slotCount) {
+        bucketMask_ = bucketCount - 1;
+        slotMask_ = slotCount - 1;
+        slots_.assign(slotCount, Slot{PromoKey{0, 0}, 0});
+        displacement_.assign(bucketCount, 0);
+        std::vector<uint8_t> used(slotCount, 0);
+
+        std::vector<std::vector<size_t>> buckets(bucketCount);
+        for (size_t id = 0; id < keys_.size(); ++id) buckets[hashKey(keys_[id]) & bucketMask_].push_back(id);
+        std::vector<size_t> order(bucketCount);
+        for (size_t b = 0; b < bucketCount; ++b) order[b] = b;
+        std::stable_sort(order.begin(), order.end(),
+                         [&](size_t a, size_t b) { return buckets[a].size() > buckets[b].size(); });
+
+        std::vector<uint64_t> chosen;
+        for (size_t b : order) {
+            if (buckets[b].empty()) break;
+            bool placed = false;
+            for (uint32_t d = 0; d <= std::numeric_limits<uint16_t>::max() && !placed; ++d) {
+                chosen.clear();
+                for (size_t id : buckets[b]) {
+                    uint64_t s = slotOf(hashKey(keys_[id]), static_cast<uint16_t>(d));
+                    if (used[s] || std::find(chosen.begin(), chosen.end(), s) != chosen.end()) break;
+                    chosen.push_back(s);
+                }
+                if (chosen.size() != buckets[b].size()) continue;
+                displacement_[b] = static_cast<uint16_t>(d);
+                for (size_t k = 0; k < chosen.size(); ++k) {
+                    used[chosen[k]] = 1;
+                    slots_[chosen[k]] = Slot{keys_[buckets[b][k]], static_cast<uint16_t>(buckets[b][k])};
+                }
+                placed = true;
+            }
+            if (!placed) return false;
+        }
+        return true;
     }
-    cout << endl;
-    cout << "Total before min fare  : " << fb.totalBeforeMin << endl;
-    cout << "Minimum fare enforced  : " << fb.totalPayable << endl;
-    cout << "-----------------------------" << endl;
-    cout << "Total payable          : " << fb.totalPayable << "\n" << endl;
+
+    std::vector<Promo> promos_;
+    std::vector<string> codes_;
+    std::vector<PromoKey> keys_;
+    std::vector<Slot> slots_;
+    std::vector<uint16_t> displacement_;
+    uint64_t bucketMask_ = 0;
+    uint64_t slotMask_ = 0;
+};
+
+// Compute the fare breakdown based on input parameters
+GRAB_FARE_EXACT_FP
+FareBreakdown computeFare(double distanceKm, double timeMin, bool isPeak,
+                          std::string_view promoCodeRaw, const Rates &rates,
+                          double peakMultiplier, double minFare,
+                          const PromoTable &promos) {
+    // Determine promo code discount
+    uint16_t promoId = promos.find(promoCodeRaw);
+    return priceTrip(distanceKm, timeMin, isPeak, rates, promoId, promos[promoId],
+                     peakMultiplier, minFare);
 }
 
-int main() {
-    // Define vehicle types and their rates.  These values roughly reflect
-    // real-world Grab fares in Malaysia (update them as needed).
-    std::map<int, Rates> vehicles{
-        {1, {2.50, 1.20, 0.20, 1.00}},  // GrabCar Economy
-        {2, {4.00, 1.60, 0.30, 1.00}},  // GrabCar Premium
-        {3, {1.50, 0.50, 0.00, 0.50}}   // GrabBike
+// Days since 1970-01-01 of a proleptic Gregorian date (Howard Hinnant's
+// days_from_civil), so timestamps need no timezone library
+static constexpr int64_t daysFromCivil(int64_t y, unsigned m, unsigned d) {
+    y -= m <= 2;
+    const int64_t era = (y >= 0 ? y : y - 399) / 400;
+    const unsigned yoe = static_cast<unsigned>(y - era * 400);
+    const unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + static_cast<int64_t>(doe) - 719468;
+}
+
+static inline int64_t floorDiv(int64_t a, int64_t b) { return a / b - ((a % b != 0) && ((a < 0) != (b < 0))); }
+
+// Parse YYYY-MM-DD.  Returns false unless it is a real date.
+static bool parseDate(std::string_view text, int64_t &day) {
+    auto digits = [&](size_t at, size_t n, unsigned &out) {
+        out = 0;
+        for (size_t i = at; i < at + n; ++i) {
+            if (text[i] < '0' || text[i] > '9') return false;
+            out = out * 10 + static_cast<unsigned>(text[i] - '0');
+        }
+        return true;
     };
+    unsigned y, m, d;
+    if (text.size() != 10 || text[4] != '-' || text[7] != '-' || !digits(0, 4, y) || !digits(5, 2, m) ||
+        !digits(8, 2, d) || m < 1 || m > 12 || d < 1) {
+        return false;
+    }
+    static const unsigned kMonthDays[] = {31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    bool leap = (y % 4 == 0 && y % 100 != 0) || y % 400 == 0;
+    if (d > kMonthDays[m - 1] || (m == 2 && d == 29 && !leap)) return false;
+    day = daysFromCivil(y, m, d);
+    return true;
+}
 
-    // Define promo codes and their discount caps
-    std::map<string, Promo> promoMap{
-        {"NONE",      {0.00, 0.00}},
-        {"GRAB10",    {0.10, 3.00}}, // 10% off up to RM3
-        {"STUDENT15", {0.15, 5.00}}, // 15% off up to RM5
-        {"SUPER20",   {0.20, 8.00}}  // 20% off up to RM8
+// Parse a UTC offset written +HH:MM or -HH:MM, up to 14 hours either way
+static bool parseUtcOffset(std::string_view text, int32_t &seconds) {
+    if (text.size() != 6 || (text[0] != '+' && text[0] != '-') || text[3] != ':') return false;
+    int hh = 0, mm = 0;
+    for (size_t i : {1, 2, 4, 5}) {
+        if (text[i] < '0' || text[i] > '9') return false;
+    }
+    hh = (text[1] - '0') * 10 + (text[2] - '0');
+    mm = (text[4] - '0') * 10 + (text[5] - '0');
+    if (hh > 14 || mm > 59) return false;
+    seconds = (text[0] == '-' ? -1 : 1) * (hh * 3600 + mm * 60);
+    return true;
+}
+
+// Parse YYYY-MM-DDTHH:MM[:SS] followed by Z, +HH:MM, -HH:MM or nothing; a
+// time without a zone is local to localOffset seconds east of UTC
+static bool parseTimestamp(std::string_view text, int32_t localOffset, int64_t &unixSeconds) {
+    int64_t day;
+    if (text.size() < 16 || text[10] != 'T' || text[13] != ':' || !parseDate(text.substr(0, 10), day)) {
+        return false;
+    }
+    auto twoDigits = [&](size_t at, int limit, int &out) {
+        if (text[at] < '0' || text[at] > '9' || text[at + 1] < '0' || text[at + 1] > '9') return false;
+        out = (text[at] - '0') * 10 + (text[at + 1] - '0');
+        return out <= limit;
     };
+    int hh, mm, ss = 0;
+    if (!twoDigits(11, 23, hh) || !twoDigits(14, 59, mm)) return false;
+    std::string_view zone = text.substr(16);
+    if (zone.size() >= 3 && zone[0] == ':') {
+        if (!twoDigits(17, 59, ss)) return false;
+        zone.remove_prefix(3);
+    }
+    int32_t offset = localOffset;
+    if (zone == "Z") {
+        offset = 0;
+    } else if (!zone.empty() && !parseUtcOffset(zone, offset)) {
+        return false;
+    }
+    unixSeconds = day * 86400 + hh * 3600 + mm * 60 + ss - offset;
+    return true;
+}
 
-    const double peakMultiplier = 1.50; // 50% surcharge on distance cost
-    const double minFare = 5.00;        // Minimum payable fare
+// Peak tier of a trip's start time.  Each weekday, and public holidays, has
+// a row of 96 fifteen-minute slots holding a tier (see
+// FareTables::peakMultipliers).  Times are taken at a fixed UTC offset,
+// UTC+8 unless the rate card says otherwise, which suits zones without
+// daylight saving.  Holidays are a bitset over days from the first one, so
+// a lookup is an add, two divisions, a bit test and a table read.
+class PeakCalendar {
+public:
+    static constexpr int kSlotsPerDay = 96;
+    static constexpr int kSlotSeconds = 900;
+    static constexpr int kRows = 8;           // Monday .. Sunday, then holidays
+    static constexpr int kHolidayRow = 7;
 
-    cout << "Grab Fare Calculator (Enhanced)" << endl;
-    cout << "Promo codes available: NONE, GRAB10, STUDENT15, SUPER20" << endl;
+    // All off-peak at UTC+8, no holidays
+    PeakCalendar() = default;
 
-    bool runAgain = true;
-    while (runAgain) {
-        // Display menu
-        cout << "\nSelect vehicle type:" << endl;
-        cout << "1) GrabCar Economy" << endl;
-        cout << "2) GrabCar Premium" << endl;
-        cout << "3) GrabBike" << endl;
+    // tiers holds kRows x kSlotsPerDay entries; bit i of holidayBits marks
+    // day firstHoliday + i (days since 1970-01-01, local)
+    PeakCalendar(int32_t utcOffsetSeconds, const uint8_t *tiers, int64_t firstHoliday,
+                 std::vector<uint64_t> holidayBits)
+        : utcOffset_(utcOffsetSeconds), firstHoliday_(firstHoliday), holidays_(std::move(holidayBits)) {
+        std::memcpy(tiers_, tiers, sizeof tiers_);
+    }
 
-        int vehicleChoice = readMenuChoice("Enter choice (1–3): ", 1, 3);
-        Rates selectedRates = vehicles.at(vehicleChoice);
-        string vehicleName;
-        switch (vehicleChoice) {
-            case 1: vehicleName = "GrabCar Economy"; break;
-            case 2: vehicleName = "GrabCar Premium"; break;
-            case 3: vehicleName = "GrabBike"; break;
-            default: vehicleName = "Unknown"; break;
+    uint8_t tierAt(int64_t unixSeconds) const {
+        int64_t local = unixSeconds + utcOffset_;
+        int64_t day = floorDiv(local, 86400);
+        int slot = static_cast<int>((local - day * 86400) / kSlotSeconds);
+        int row = isHoliday(day) ? kHolidayRow : weekday(day);
+        return tiers_[row][slot];
+    }
+
+    bool isHoliday(int64_t day) const {
+        uint64_t offset = static_cast<uint64_t>(day - firstHoliday_);
+        return offset < holidays_.size() * 64 && (holidays_[offset / 64] >> (offset % 64) & 1) != 0;
+    }
+
+    // 0 for Monday; 1970-01-01 was a Thursday
+    static int weekday(int64_t day) { return static_cast<int>(day + 3 - floorDiv(day + 3, 7) * 7); }
+
+    int32_t utcOffsetSeconds() const { return utcOffset_; }
+    const uint8_t *tiers() const { return &tiers_[0][0]; }
+    int64_t firstHoliday() const { return firstHoliday_; }
+    const std::vector<uint64_t> &holidayBits() const { return holidays_; }
+
+private:
+    int32_t utcOffset_ = 8 * 3600;
+    uint8_t tiers_[kRows][kSlotsPerDay] = {};
+    int64_t firstHoliday_ = 0;
+    std::vector<uint64_t> holidays_;
+};
+
+// Pricing tables flattened for the batch path.  Vehicles and promos are
+// addressed by small integer ids so the hot loop never touches a map or a
+// string.  A trip's peak flag is a tier: 0 is off-peak, 1 is the card's
+// peak multiplier, and the calendar may use further tiers for other
+// multipliers.
+struct FareTables {
+    std::vector<Rates> ratesById;        // indexed by vehicle id
+    std::vector<uint8_t> vehicleKnown;   // 1 if ratesById[id] is defined
+    PromoTable promos;                   // indexed by promo id
+    double peakMultiplier;               // tier 1
+    double minFare;
+    std::vector<double> peakMultipliers; // indexed by peak tier, 256 entries
+    PeakCalendar calendar;
+    uint64_t generation = 0;             // set by RateCardStore::publish()
+};
+
+// Build batch tables from the same maps the interactive calculator uses
+FareTables buildFareTables(const std::map<int, Rates> &vehicles,
+                           const std::map<string, Promo> &promoMap,
+                           double peakMultiplier, double minFare) {
+    FareTables tables{};
+    tables.peakMultiplier = peakMultiplier;
+    tables.minFare = minFare;
+    tables.peakMultipliers.assign(256, peakMultiplier);
+    tables.peakMultipliers[0] = 1.0;
+
+    for (const auto &entry : vehicles) {
+        if (entry.first < 0 || entry.first > 255) {
+            throw std::invalid_argument("vehicle id out of range: " + std::to_string(entry.first));
+        }
+        if (!isTimeMetered(entry.first) && entry.second.perMin != 0) {
+            throw std::invalid_argument("vehicle " + std::to_string(entry.first) +
+                                        " is not time metered but has a per-minute rate");
         }
+        size_t id = static_cast<size_t>(entry.first);
+        if (tables.ratesById.size() <= id) {
+            tables.ratesById.resize(id + 1, Rates{0, 0, 0, 0});
+            tables.vehicleKnown.resize(id + 1, 0);
+        }
+        tables.ratesById[id] = entry.second;
+        tables.vehicleKnown[id] = 1;
+    }
+    tables.promos = PromoTable(promoMap);
+    return tables;
+}
 
-        cout << "Selected: " << vehicleName << endl;
-        cout << "Base fare: RM " << selectedRates.base
-             << ", Per km: RM " << selectedRates.perKm
-             << ", Booking fee: RM " << selectedRates.bookingFee;
-        if (selectedRates.perMin > 0) {
-            cout << ", Per minute: RM " << selectedRates.perMin;
+// Compute the fare of a trip starting at startUnixSeconds, taking its peak
+// multiplier from the tables' calendar.  Throws std::out_of_range for an
+// unknown vehicle.
+GRAB_FARE_EXACT_FP
+FareBreakdown computeFareAt(const FareTables &tables, int vehicleId, double distanceKm, double timeMin,
+                            int64_t startUnixSeconds, std::string_view promoCodeRaw) {
+    if (vehicleId < 0 || static_cast<size_t>(vehicleId) >= tables.vehicleKnown.size() ||
+        !tables.vehicleKnown[static_cast<size_t>(vehicleId)]) {
+        throw std::out_of_range("computeFareAt: unknown vehicle id " + std::to_string(vehicleId));
+    }
+    uint8_t tier = tables.calendar.tierAt(startUnixSeconds);
+    uint16_t promoId = tables.promos.find(promoCodeRaw);
+    return priceTrip(distanceKm, timeMin, tier != 0, tables.ratesById[static_cast<size_t>(vehicleId)], promoId,
+                     tables.promos[promoId], tables.peakMultipliers[tier], tables.minFare);
+}
+
+// Trip inputs laid out as parallel columns (structure of arrays).  Row i of
+// every column describes the same trip.
+struct TripColumns {
+    const double *distanceKm;
+    const double *timeMin;
+    const uint8_t *vehicleId;
+    const uint8_t *isPeak;       // peak tier, 0 = off-peak (FareTables::peakMultipliers)
+    const uint16_t *promoId;     // from PromoTable::find(); out-of-range ids mean NONE
+    size_t count;
+    const double *surge = nullptr;   // optional, multiplies the peak multiplier
+};
+
+// Caller-owned output columns, each with room for TripColumns::count rows.
+// Any pointer may be left null to skip that column.
+struct FareColumns {
+    double *base;
+    double *booking;
+    double *distanceCostOffPeak;
+    double *timeCost;
+    double *peakMultiplier;
+    double *distanceCostFinal;
+    double *subtotal;
+    uint16_t *promoId;           // promo actually applied
+    double *discountApplied;
+    double *totalBeforeMin;
+    double *totalPayable;
+};
+
+// Instruction sets the batch kernel can run on, best last
+enum class SimdLevel { Scalar, Avx2, Avx512 };
+
+const char *simdLevelName(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::Avx2: return "avx2";
+        case SimdLevel::Avx512: return "avx512";
+        default: return "scalar";
+    }
+}
+
+// Best level this CPU supports.  GRAB_FARE_SIMD=scalar|avx2|avx512 in the
+// environment can lower (never raise) the choice.
+SimdLevel detectSimdLevel() {
+    SimdLevel best = SimdLevel::Scalar;
+#ifdef GRAB_FARE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) best = SimdLevel::Avx2;
+    if (__builtin_cpu_supports("avx512f")) best = SimdLevel::Avx512;
+#endif
+    const char *env = std::getenv("GRAB_FARE_SIMD");
+    if (env != nullptr) {
+        SimdLevel wanted = best;
+        if (std::strcmp(env, "scalar") == 0) wanted = SimdLevel::Scalar;
+        else if (std::strcmp(env, "avx2") == 0) wanted = SimdLevel::Avx2;
+        else if (std::strcmp(env, "avx512") == 0) wanted = SimdLevel::Avx512;
+        if (wanted < best) best = wanted;
+    }
+    return best;
+}
+
+// The row kernels below are templates over two compile-time facts:
+//   TimeMetered  false drops the time term (timeMin is never read and the
+//                timeCost column is all zero), for classes like GrabBike
+//   Uniform      true means every row uses the rates of uniformVehicle, so
+//                they are loaded once instead of looked up per row
+// The generic path is <true, false>.
+
+// Scalar batch loop over rows [begin, end); vehicle ids already validated
+template <bool TimeMetered, bool Uniform>
+GRAB_FARE_EXACT_FP
+static void computeFareRowsScalar(const TripColumns &trips, const FareTables &tables,
+                                  const FareColumns &out, size_t begin, size_t end,
+                                  uint8_t uniformVehicle) {
+    const size_t promoCount = tables.promos.size();
+    for (size_t i = begin; i < end; ++i) {
+        uint16_t promoId = (trips.promoId[i] < promoCount) ? trips.promoId[i] : 0;
+        const Rates &rates = tables.ratesById[Uniform ? uniformVehicle : trips.vehicleId[i]];
+        double multiplier = tables.peakMultipliers[trips.isPeak[i]];
+        if (trips.surge) multiplier *= trips.surge[i];
+        FareBreakdown fb = priceTrip<TimeMetered>(trips.distanceKm[i], TimeMetered ? trips.timeMin[i] : 0.0,
+                                                  multiplier != 1.0, rates, promoId, tables.promos[promoId],
+                                                  multiplier, tables.minFare);
+        if (out.base) out.base[i] = fb.base;
+        if (out.booking) out.booking[i] = fb.booking;
+        if (out.distanceCostOffPeak) out.distanceCostOffPeak[i] = fb.distanceCostOffPeak;
+        if (out.timeCost) out.timeCost[i] = fb.timeCost;
+        if (out.peakMultiplier) out.peakMultiplier[i] = fb.peakMultiplier;
+        if (out.distanceCostFinal) out.distanceCostFinal[i] = fb.distanceCostFinal;
+        if (out.subtotal) out.subtotal[i] = fb.subtotal;
+        if (out.promoId) out.promoId[i] = promoId;
+        if (out.discountApplied) out.discountApplied[i] = fb.discountApplied;
+        if (out.totalBeforeMin) out.totalBeforeMin[i] = fb.totalBeforeMin;
+        if (out.totalPayable) out.totalPayable[i] = fb.totalPayable;
+    }
+}
+
+#ifdef GRAB_FARE_X86_SIMD
+// The vector kernels below repeat priceTrip() operation for operation, so
+// every lane is bit-identical to the scalar result.  round2 is rebuilt from
+// truncation because SSE/AVX rounding has no half-away-from-zero mode:
+// round(x) = trunc(x) + copysign(1, x) when |x - trunc(x)| >= 0.5 (the
+// subtraction is exact).  This only holds without FMA contraction, so the
+// kernels are GRAB_FARE_EXACT_FP like priceTrip().
+static_assert(sizeof(Rates) == 4 * sizeof(double), "Rates is gathered as 4 doubles");
+static_assert(sizeof(Promo) == 2 * sizeof(double), "Promo is gathered as 2 doubles");
+
+__attribute__((target("avx2"))) GRAB_FARE_EXACT_FP
+static inline __m256d round2Avx2(__m256d v) {
+    const __m256d hundred = _mm256_set1_pd(100.0);
+    const __m256d signMask = _mm256_set1_pd(-0.0);
+    __m256d x = _mm256_mul_pd(v, hundred);
+    __m256d t = _mm256_round_pd(x, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+    __m256d frac = _mm256_andnot_pd(signMask, _mm256_sub_pd(x, t));
+    __m256d away = _mm256_cmp_pd(frac, _mm256_set1_pd(0.5), _CMP_GE_OQ);
+    __m256d step = _mm256_or_pd(_mm256_and_pd(x, signMask), _mm256_set1_pd(1.0));
+    __m256d r = _mm256_blendv_pd(t, _mm256_add_pd(t, step), away);
+    return _mm256_div_pd(r, hundred);
+}
+
+template <bool TimeMetered, bool Uniform>
+__attribute__((target("avx2"))) GRAB_FARE_EXACT_FP
+static void computeFareRowsAvx2(const TripColumns &trips, const FareTables &tables,
+                                const FareColumns &out, size_t begin, size_t end,
+                                uint8_t uniformVehicle) {
+    const double *rates = &tables.ratesById[0].base;
+    const double *promos = &tables.promos[0].percentage;
+    const Rates &uniform = tables.ratesById[uniformVehicle];
+    const __m256i promoCount = _mm256_set1_epi64x(static_cast<long long>(tables.promos.size()));
+    const double *peakMultipliers = tables.peakMultipliers.data();
+    const __m256d minFare = _mm256_set1_pd(tables.minFare);
+    const __m256d zero = _mm256_setzero_pd();
+
+    size_t i = begin;
+    for (; i + 4 <= end; i += 4) {
+        uint32_t peakBytes;
+        uint64_t promoWords;
+        std::memcpy(&peakBytes, trips.isPeak + i, sizeof peakBytes);
+        std::memcpy(&promoWords, trips.promoId + i, sizeof promoWords);
+
+        __m256d base = _mm256_set1_pd(uniform.base);
+        __m256d perKm = _mm256_set1_pd(uniform.perKm);
+        __m256d perMin = _mm256_set1_pd(uniform.perMin);
+        __m256d booking = _mm256_set1_pd(uniform.bookingFee);
+        if constexpr (!Uniform) {
+            uint32_t vehicleBytes;
+            std::memcpy(&vehicleBytes, trips.vehicleId + i, sizeof vehicleBytes);
+            __m256i rateIdx = _mm256_slli_epi64(_mm256_cvtepu8_epi64(_mm_cvtsi32_si128(static_cast<int>(vehicleBytes))), 2);
+            base = _mm256_i64gather_pd(rates + 0, rateIdx, 8);
+            perKm = _mm256_i64gather_pd(rates + 1, rateIdx, 8);
+            if constexpr (TimeMetered) perMin = _mm256_i64gather_pd(rates + 2, rateIdx, 8);
+            booking = _mm256_i64gather_pd(rates + 3, rateIdx, 8);
         }
-        cout << endl;
 
-        // Read trip details
-        double distanceKm;
-        if (!readPositiveDouble("Enter trip distance (km): ", distanceKm, 200.0)) {
-            cout << "Input ended unexpectedly. Exiting." << endl;
-            return 0;
+        __m256i promoId = _mm256_cvtepu16_epi64(_mm_cvtsi64_si128(static_cast<long long>(promoWords)));
+        promoId = _mm256_and_si256(promoId, _mm256_cmpgt_epi64(promoCount, promoId));
+        __m256i promoIdx = _mm256_slli_epi64(promoId, 1);
+        __m256d percentage = _mm256_i64gather_pd(promos + 0, promoIdx, 8);
+        __m256d cap = _mm256_i64gather_pd(promos + 1, promoIdx, 8);
+
+        __m256i peak = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(static_cast<int>(peakBytes)));
+        __m256d multiplier = _mm256_i64gather_pd(peakMultipliers, peak, 8);
+        if (trips.surge) multiplier = _mm256_mul_pd(multiplier, _mm256_loadu_pd(trips.surge + i));
+
+        __m256d distanceCostOffPeak = _mm256_mul_pd(_mm256_loadu_pd(trips.distanceKm + i), perKm);
+        __m256d distanceCostFinal = _mm256_mul_pd(distanceCostOffPeak, multiplier);
+        __m256d subtotal = _mm256_add_pd(_mm256_add_pd(base, booking), distanceCostFinal);
+        __m256d timeCost = zero;
+        if constexpr (TimeMetered) {
+            timeCost = _mm256_mul_pd(_mm256_loadu_pd(trips.timeMin + i), perMin);
+            subtotal = _mm256_add_pd(subtotal, timeCost);
         }
-        double timeMin = 0;
-        if (selectedRates.perMin > 0) {
-            if (!readPositiveDouble("Enter estimated time (minutes): ", timeMin, 1000.0)) {
-                cout << "Input ended unexpectedly. Exiting." << endl;
-                return 0;
-            }
+        __m256d discount = _mm256_min_pd(cap, _mm256_mul_pd(subtotal, percentage));
+        __m256d totalBeforeMin = _mm256_sub_pd(subtotal, discount);
+        __m256d totalPayable = _mm256_max_pd(minFare, totalBeforeMin);
+
+        if (out.base) _mm256_storeu_pd(out.base + i, round2Avx2(base));
+        if (out.booking) _mm256_storeu_pd(out.booking + i, round2Avx2(booking));
+        if (out.distanceCostOffPeak) _mm256_storeu_pd(out.distanceCostOffPeak + i, round2Avx2(distanceCostOffPeak));
+        if (out.timeCost) _mm256_storeu_pd(out.timeCost + i, TimeMetered ? round2Avx2(timeCost) : zero);
+        if (out.peakMultiplier) _mm256_storeu_pd(out.peakMultiplier + i, multiplier);
+        if (out.distanceCostFinal) _mm256_storeu_pd(out.distanceCostFinal + i, round2Avx2(distanceCostFinal));
+        if (out.subtotal) _mm256_storeu_pd(out.subtotal + i, round2Avx2(subtotal));
+        if (out.promoId) {
+            alignas(32) uint64_t ids[4];
+            _mm256_store_si256(reinterpret_cast<__m256i *>(ids), promoId);
+            uint64_t words = ids[0] | ids[1] << 16 | ids[2] << 32 | ids[3] << 48;
+            std::memcpy(out.promoId + i, &words, sizeof words);
         }
+        if (out.discountApplied) _mm256_storeu_pd(out.discountApplied + i, round2Avx2(discount));
+        if (out.totalBeforeMin) _mm256_storeu_pd(out.totalBeforeMin + i, round2Avx2(totalBeforeMin));
+        if (out.totalPayable) _mm256_storeu_pd(out.totalPayable + i, round2Avx2(totalPayable));
+    }
+    computeFareRowsScalar<TimeMetered, Uniform>(trips, tables, out, i, end, uniformVehicle);
+}
 
-        // Determine peak or off-peak
-        int peakChoice = readMenuChoice("Is this a peak‑hour ride? 1) No  2) Yes : ", 1, 2);
-        bool isPeak = (peakChoice == 2);
+// GCC 12's AVX-512 headers trip -Wmaybe-uninitialized on their own
+// _mm512_undefined_* placeholders; the warning is spurious.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
 
-        // Ask for promo code
-        cout << "Enter promo code (or NONE): ";
-        string promoInput;
-        cin >> promoInput;
+__attribute__((target("avx512f"))) GRAB_FARE_EXACT_FP
+static inline __m512d round2Avx512(__m512d v) {
+    const __m512d hundred = _mm512_set1_pd(100.0);
+    const __m512i signMask = _mm512_set1_epi64(static_cast<long long>(0x8000000000000000ULL));
+    __m512d x = _mm512_mul_pd(v, hundred);
+    __m512d t = _mm512_roundscale_pd(x, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+    __m512d frac = _mm512_abs_pd(_mm512_sub_pd(x, t));
+    __mmask8 away = _mm512_cmp_pd_mask(frac, _mm512_set1_pd(0.5), _CMP_GE_OQ);
+    __m512d step = _mm512_castsi512_pd(_mm512_or_si512(
+        _mm512_and_si512(_mm512_castpd_si512(x), signMask),
+        _mm512_castpd_si512(_mm512_set1_pd(1.0))));
+    __m512d r = _mm512_mask_add_pd(t, away, t, step);
+    return _mm512_div_pd(r, hundred);
+}
 
-        // Compute fare
-        FareBreakdown fb = computeFare(distanceKm, timeMin, isPeak,
-                                      promoInput, selectedRates,
-                                      peakMultiplier, minFare,
-                                      promoMap);
-
-        // Print summary
-        cout << "\n=== Summary =================================\n";
-        cout << "Vehicle: " << vehicleName << " | "
-             << (isPeak ? "Peak" : "Off-peak") << " | Distance: "
-             << std::fixed << std::setprecision(2) << distanceKm << " km";
-        if (selectedRates.perMin > 0) cout << " | Time: " << timeMin << " min";
-        cout << "\n=============================================\n";
-
-        printBreakdown(fb);
+template <bool TimeMetered, bool Uniform>
+__attribute__((target("avx512f"))) GRAB_FARE_EXACT_FP
+static void computeFareRowsAvx512(const TripColumns &trips, const FareTables &tables,
+                                  const FareColumns &out, size_t begin, size_t end,
+                                  uint8_t uniformVehicle) {
+    const double *rates = &tables.ratesById[0].base;
+    const double *promos = &tables.promos[0].percentage;
+    const Rates &uniform = tables.ratesById[uniformVehicle];
+    const __m512i promoCount = _mm512_set1_epi64(static_cast<long long>(tables.promos.size()));
+    const double *peakMultipliers = tables.peakMultipliers.data();
+    const __m512d minFare = _mm512_set1_pd(tables.minFare);
+    const __m512d zero = _mm512_setzero_pd();
+
+    size_t i = begin;
+    for (; i + 8 <= end; i += 8) {
+        __m128i peakBytes = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(trips.isPeak + i));
+        __m128i promoWords = _mm_loadu_si128(reinterpret_cast<const __m128i *>(trips.promoId + i));
+
+        __m512d base = _mm512_set1_pd(uniform.base);
+        __m512d perKm = _mm512_set1_pd(uniform.perKm);
+        __m512d perMin = _mm512_set1_pd(uniform.perMin);
+        __m512d booking = _mm512_set1_pd(uniform.bookingFee);
+        if constexpr (!Uniform) {
+            __m128i vehicleBytes = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(trips.vehicleId + i));
+            __m512i rateIdx = _mm512_slli_epi64(_mm512_cvtepu8_epi64(vehicleBytes), 2);
+            base = _mm512_i64gather_pd(rateIdx, rates + 0, 8);
+            perKm = _mm512_i64gather_pd(rateIdx, rates + 1, 8);
+            if constexpr (TimeMetered) perMin = _mm512_i64gather_pd(rateIdx, rates + 2, 8);
+            booking = _mm512_i64gather_pd(rateIdx, rates + 3, 8);
+        }
+
+        __m512i promoId = _mm512_cvtepu16_epi64(promoWords);
+        promoId = _mm512_maskz_mov_epi64(_mm512_cmplt_epu64_mask(promoId, promoCount), promoId);
+        __m512i promoIdx = _mm512_slli_epi64(promoId, 1);
+        __m512d percentage = _mm512_i64gather_pd(promoIdx, promos + 0, 8);
+        __m512d cap = _mm512_i64gather_pd(promoIdx, promos + 1, 8);
+
+        __m512d multiplier = _mm512_i64gather_pd(_mm512_cvtepu8_epi64(peakBytes), peakMultipliers, 8);
+        if (trips.surge) multiplier = _mm512_mul_pd(multiplier, _mm512_loadu_pd(trips.surge + i));
+
+        __m512d distanceCostOffPeak = _mm512_mul_pd(_mm512_loadu_pd(trips.distanceKm + i), perKm);
+        __m512d distanceCostFinal = _mm512_mul_pd(distanceCostOffPeak, multiplier);
+        __m512d subtotal = _mm512_add_pd(_mm512_add_pd(base, booking), distanceCostFinal);
+        __m512d timeCost = zero;
+        if constexpr (TimeMetered) {
+            timeCost = _mm512_mul_pd(_mm512_loadu_pd(trips.timeMin + i), perMin);
+            subtotal = _mm512_add_pd(subtotal, timeCost);
+        }
+        __m512d discount = _mm512_min_pd(cap, _mm512_mul_pd(subtotal, percentage));
+        __m512d totalBeforeMin = _mm512_sub_pd(subtotal, discount);
+        __m512d totalPayable = _mm512_max_pd(minFare, totalBeforeMin);
+
+        if (out.base) _mm512_storeu_pd(out.base + i, round2Avx512(base));
+        if (out.booking) _mm512_storeu_pd(out.booking + i, round2Avx512(booking));
+        if (out.distanceCostOffPeak) _mm512_storeu_pd(out.distanceCostOffPeak + i, round2Avx512(distanceCostOffPeak));
+        if (out.timeCost) _mm512_storeu_pd(out.timeCost + i, TimeMetered ? round2Avx512(timeCost) : zero);
+        if (out.peakMultiplier) _mm512_storeu_pd(out.peakMultiplier + i, multiplier);
+        if (out.distanceCostFinal) _mm512_storeu_pd(out.distanceCostFinal + i, round2Avx512(distanceCostFinal));
+        if (out.subtotal) _mm512_storeu_pd(out.subtotal + i, round2Avx512(subtotal));
+        if (out.promoId) {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out.promoId + i), _mm512_cvtepi64_epi16(promoId));
+        }
+        if (out.discountApplied) _mm512_storeu_pd(out.discountApplied + i, round2Avx512(discount));
+        if (out.totalBeforeMin) _mm512_storeu_pd(out.totalBeforeMin + i, round2Avx512(totalBeforeMin));
+        if (out.totalPayable) _mm512_storeu_pd(out.totalPayable + i, round2Avx512(totalPayable));
+    }
+    computeFareRowsScalar<TimeMetered, Uniform>(trips, tables, out, i, end, uniformVehicle);
+}
+
+#pragma GCC diagnostic pop
+#endif
+
+// Best level the running CPU supports, detected once
+static SimdLevel supportedSimdLevel() {
+    static const SimdLevel level = detectSimdLevel();
+    return level;
+}
+
+// Run one kernel instantiation over all rows on the requested level, or
+// scalar if the CPU lacks it
+template <bool TimeMetered, bool Uniform>
+static void dispatchFareRows(SimdLevel level, const TripColumns &trips, const FareTables &tables,
+                             const FareColumns &out, uint8_t uniformVehicle) {
+    if (trips.count == 0) return;
+    if (level > supportedSimdLevel()) level = SimdLevel::Scalar;
+#ifdef GRAB_FARE_X86_SIMD
+    if (level == SimdLevel::Avx512) {
+        computeFareRowsAvx512<TimeMetered, Uniform>(trips, tables, out, 0, trips.count, uniformVehicle);
+        return;
+    }
+    if (level == SimdLevel::Avx2) {
+        computeFareRowsAvx2<TimeMetered, Uniform>(trips, tables, out, 0, trips.count, uniformVehicle);
+        return;
+    }
+#endif
+    computeFareRowsScalar<TimeMetered, Uniform>(trips, tables, out, 0, trips.count, uniformVehicle);
+}
+
+// Price a whole column set on the given instruction set.  Row i gets exactly
+// the values computeFare() would return for the same trip.  Nothing is
+// allocated; an unknown vehicle id throws std::out_of_range like
+// vehicles.at() does in main().  Levels the CPU lacks fall back to scalar.
+void computeFareBatchWith(SimdLevel level, const TripColumns &trips,
+                          const FareTables &tables, const FareColumns &out) {
+    const size_t vehicleCount = tables.ratesById.size();
+    for (size_t i = 0; i < trips.count; ++i) {
+        size_t vehicle = trips.vehicleId[i];
+        if (vehicle >= vehicleCount || !tables.vehicleKnown[vehicle]) {
+            throw std::out_of_range("computeFareBatch: unknown vehicle id " + std::to_string(vehicle));
+        }
+    }
+    dispatchFareRows<true, false>(level, trips, tables, out, 0);
+}
+
+// Price a whole column set on the best instruction set available
+void computeFareBatch(const TripColumns &trips, const FareTables &tables,
+                      const FareColumns &out) {
+    computeFareBatchWith(supportedSimdLevel(), trips, tables, out);
+}
+
+// Price a column set in which every trip uses vehicle class V, with V's
+// unused terms compiled out.  trips.vehicleId is not read and may be null;
+// so may trips.timeMin for classes that are not time metered.  Results are
+// identical to computeFareBatch().  Throws std::out_of_range if the tables
+// have no rates for V.
+template <Vehicle V>
+void computeFareBatchAs(const TripColumns &trips, const FareTables &tables, const FareColumns &out,
+                        SimdLevel level = supportedSimdLevel()) {
+    const uint8_t vehicle = static_cast<uint8_t>(V);
+    if (vehicle >= tables.ratesById.size() || !tables.vehicleKnown[vehicle]) {
+        throw std::out_of_range("computeFareBatchAs: no rates for vehicle id " + std::to_string(vehicle));
+    }
+    dispatchFareRows<VehicleClass<V>::timeMetered, true>(level, trips, tables, out, vehicle);
+}
+
+// ---------------------------------------------------------------------------
+// Trip distance from coordinates.  computeDistanceBatch() turns pickup and
+// drop-off latitude/longitude columns, in degrees, into a distanceKm column
+// that computeFareBatch() reads as it is, so raw GPS points are priced in
+// one pass.  Two models:
+//   Haversine        great-circle distance on a sphere of the Earth's mean
+//                    radius
+//   Equirectangular  the two points projected onto a plane at their mean
+//                    latitude; cheaper, and within 0.2% of haversine for
+//                    trips under 200 km below 80 degrees of latitude
+//
+// The kernels bring their own sin, cos and asin so the vector paths need no
+// libm calls: Taylor polynomials on [-pi/2, pi/2] (sin to x^15, cos to
+// x^16) and on [0, 1/2] for asin (to x^29), with asin(x) = pi/2 -
+// 2 asin(sqrt((1 - x) / 2)) above 1/2.  Latitudes in [-90, 90] and
+// longitude differences wrapped to [-180, 180] keep every argument in range.
+// Each approximation is within 1e-11 of the true value, which puts city
+// trips within a micrometre of the exact great-circle distance; only near
+// the antipode, where asin is ill-conditioned, does the error reach 0.4 m.
+// The scalar, AVX2 and AVX-512 paths do the same operations in the same
+// order and agree bit for bit.  GCC contracts a * b + c into an FMA by
+// default for C++ whenever the target has one (always for AVX-512, and for
+// every path under -march=native), rounding once where the other paths
+// round twice, so all of the distance code below is built with
+// fp-contract=off.
+// ---------------------------------------------------------------------------
+
+enum class DistanceModel : uint8_t { Haversine, Equirectangular };
+
+// Trip endpoints as parallel columns, in degrees
+struct CoordColumns {
+    const double *pickupLat;
+    const double *pickupLon;
+    const double *dropoffLat;
+    const double *dropoffLon;
+    size_t count;
+};
+
+constexpr double kEarthRadiusKm = 6371.0088;   // IUGG mean radius
+constexpr double kRadiansPerDegree = 3.14159265358979323846 / 180;
+constexpr double kHalfPi = 1.57079632679489661923;
+
+// Taylor coefficients, highest order first.  sin x = x + x z P(z) and
+// cos x = 1 + z P(z) with z = x^2; asin x = x + x z P(z).
+constexpr double kSinPoly[] = {-1.0 / 1307674368000, 1.0 / 6227020800, -1.0 / 39916800, 1.0 / 362880,
+                               -1.0 / 5040, 1.0 / 120, -1.0 / 6};
+constexpr double kCosPoly[] = {1.0 / 20922789888000, -1.0 / 87178291200, 1.0 / 479001600, -1.0 / 3628800,
+                               1.0 / 40320, -1.0 / 720, 1.0 / 24, -1.0 / 2};
+constexpr double kAsinPoly[] = {5014575.0 / 973078528, 1300075.0 / 226492416, 676039.0 / 104857600,
+                                88179.0 / 12058624, 46189.0 / 5505024, 12155.0 / 1245184,
+                                6435.0 / 557056, 143.0 / 10240, 231.0 / 13312, 63.0 / 2816,
+                                35.0 / 1152, 5.0 / 112, 3.0 / 40, 1.0 / 6};
+
+#pragma GCC push_options
+#pragma GCC optimize("fp-contract=off")
+
+template <size_t N>
+static inline double hornerScalar(const double (&c)[N], double z) {
+    double p = c[0];
+    for (size_t k = 1; k < N; ++k) p = p * z + c[k];
+    return p;
+}
+
+static inline double sinApprox(double x) {
+    double z = x * x;
+    return x + x * z * hornerScalar(kSinPoly, z);
+}
+
+static inline double cosApprox(double x) {
+    double z = x * x;
+    return 1.0 + z * hornerScalar(kCosPoly, z);
+}
+
+// x in [0, 1]
+static inline double asinApprox(double x) {
+    bool reduce = x > 0.5;
+    double y = reduce ? std::sqrt((1.0 - x) * 0.5) : x;
+    double z = y * y;
+    double r = y + y * z * hornerScalar(kAsinPoly, z);
+    return reduce ? kHalfPi - 2.0 * r : r;
+}
+
+// Kilometres between two points given in degrees
+static inline double tripDistanceKm(double lat1, double lon1, double lat2, double lon2, DistanceModel model) {
+    double dLat = (lat2 - lat1) * kRadiansPerDegree;
+    double dLon = lon2 - lon1;
+    dLon = (dLon - 360.0 * std::nearbyint(dLon * (1.0 / 360))) * kRadiansPerDegree;
+    if (model == DistanceModel::Equirectangular) {
+        double x = dLon * cosApprox((lat1 + lat2) * (0.5 * kRadiansPerDegree));
+        return kEarthRadiusKm * std::sqrt(x * x + dLat * dLat);
+    }
+    double sLat = sinApprox(dLat * 0.5);
+    double sLon = sinApprox(dLon * 0.5);
+    double cosProduct = cosApprox(lat1 * kRadiansPerDegree) * cosApprox(lat2 * kRadiansPerDegree);
+    double a = std::min(1.0, sLat * sLat + cosProduct * (sLon * sLon));
+    return (2.0 * kEarthRadiusKm) * asinApprox(std::sqrt(a));
+}
+
+static void computeDistanceRowsScalar(const CoordColumns &c, DistanceModel model, double *distanceKm,
+                                      size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+        distanceKm[i] = tripDistanceKm(c.pickupLat[i], c.pickupLon[i], c.dropoffLat[i], c.dropoffLon[i], model);
+    }
+}
+
+#ifdef GRAB_FARE_X86_SIMD
+template <size_t N>
+__attribute__((target("avx2")))
+static inline __m256d hornerAvx2(const double (&c)[N], __m256d z) {
+    __m256d p = _mm256_set1_pd(c[0]);
+    for (size_t k = 1; k < N; ++k) p = _mm256_add_pd(_mm256_mul_pd(p, z), _mm256_set1_pd(c[k]));
+    return p;
+}
+
+__attribute__((target("avx2")))
+static inline __m256d sinAvx2(__m256d x) {
+    __m256d z = _mm256_mul_pd(x, x);
+    return _mm256_add_pd(x, _mm256_mul_pd(_mm256_mul_pd(x, z), hornerAvx2(kSinPoly, z)));
+}
+
+__attribute__((target("avx2")))
+static inline __m256d cosAvx2(__m256d x) {
+    __m256d z = _mm256_mul_pd(x, x);
+    return _mm256_add_pd(_mm256_set1_pd(1.0), _mm256_mul_pd(z, hornerAvx2(kCosPoly, z)));
+}
+
+__attribute__((target("avx2")))
+static inline __m256d asinAvx2(__m256d x) {
+    __m256d reduce = _mm256_cmp_pd(x, _mm256_set1_pd(0.5), _CMP_GT_OQ);
+    __m256d reduced = _mm256_sqrt_pd(_mm256_mul_pd(_mm256_sub_pd(_mm256_set1_pd(1.0), x), _mm256_set1_pd(0.5)));
+    __m256d y = _mm256_blendv_pd(x, reduced, reduce);
+    __m256d z = _mm256_mul_pd(y, y);
+    __m256d r = _mm256_add_pd(y, _mm256_mul_pd(_mm256_mul_pd(y, z), hornerAvx2(kAsinPoly, z)));
+    __m256d unreduced = _mm256_sub_pd(_mm256_set1_pd(kHalfPi), _mm256_mul_pd(_mm256_set1_pd(2.0), r));
+    return _mm256_blendv_pd(r, unreduced, reduce);
+}
+
+__attribute__((target("avx2")))
+static void computeDistanceRowsAvx2(const CoordColumns &c, DistanceModel model, double *distanceKm,
+                                    size_t begin, size_t end) {
+    const __m256d toRadians = _mm256_set1_pd(kRadiansPerDegree);
+    const __m256d half = _mm256_set1_pd(0.5);
+    size_t i = begin;
+    for (; i + 4 <= end; i += 4) {
+        __m256d lat1 = _mm256_loadu_pd(c.pickupLat + i);
+        __m256d lat2 = _mm256_loadu_pd(c.dropoffLat + i);
+        __m256d dLat = _mm256_mul_pd(_mm256_sub_pd(lat2, lat1), toRadians);
+        __m256d dLon = _mm256_sub_pd(_mm256_loadu_pd(c.dropoffLon + i), _mm256_loadu_pd(c.pickupLon + i));
+        __m256d turns = _mm256_round_pd(_mm256_mul_pd(dLon, _mm256_set1_pd(1.0 / 360)),
+                                        _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        dLon = _mm256_mul_pd(_mm256_sub_pd(dLon, _mm256_mul_pd(_mm256_set1_pd(360.0), turns)), toRadians);
+        __m256d d;
+        if (model == DistanceModel::Equirectangular) {
+            __m256d meanLat = _mm256_mul_pd(_mm256_add_pd(lat1, lat2), _mm256_set1_pd(0.5 * kRadiansPerDegree));
+            __m256d x = _mm256_mul_pd(dLon, cosAvx2(meanLat));
+            __m256d sum = _mm256_add_pd(_mm256_mul_pd(x, x), _mm256_mul_pd(dLat, dLat));
+            d = _mm256_mul_pd(_mm256_set1_pd(kEarthRadiusKm), _mm256_sqrt_pd(sum));
+        } else {
+            __m256d sLat = sinAvx2(_mm256_mul_pd(dLat, half));
+            __m256d sLon = sinAvx2(_mm256_mul_pd(dLon, half));
+            __m256d cosProduct = _mm256_mul_pd(cosAvx2(_mm256_mul_pd(lat1, toRadians)),
+                                               cosAvx2(_mm256_mul_pd(lat2, toRadians)));
+            __m256d a = _mm256_add_pd(_mm256_mul_pd(sLat, sLat), _mm256_mul_pd(cosProduct, _mm256_mul_pd(sLon, sLon)));
+            a = _mm256_min_pd(_mm256_set1_pd(1.0), a);
+            d = _mm256_mul_pd(_mm256_set1_pd(2.0 * kEarthRadiusKm), asinAvx2(_mm256_sqrt_pd(a)));
+        }
+        _mm256_storeu_pd(distanceKm + i, d);
+    }
+    computeDistanceRowsScalar(c, model, distanceKm, i, end);
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+template <size_t N>
+__attribute__((target("avx512f")))
+static inline __m512d hornerAvx512(const double (&c)[N], __m512d z) {
+    __m512d p = _mm512_set1_pd(c[0]);
+    for (size_t k = 1; k < N; ++k) p = _mm512_add_pd(_mm512_mul_pd(p, z), _mm512_set1_pd(c[k]));
+    return p;
+}
+
+__attribute__((target("avx512f")))
+static inline __m512d sinAvx512(__m512d x) {
+    __m512d z = _mm512_mul_pd(x, x);
+    return _mm512_add_pd(x, _mm512_mul_pd(_mm512_mul_pd(x, z), hornerAvx512(kSinPoly, z)));
+}
+
+__attribute__((target("avx512f")))
+static inline __m512d cosAvx512(__m512d x) {
+    __m512d z = _mm512_mul_pd(x, x);
+    return _mm512_add_pd(_mm512_set1_pd(1.0), _mm512_mul_pd(z, hornerAvx512(kCosPoly, z)));
+}
+
+__attribute__((target("avx512f")))
+static inline __m512d asinAvx512(__m512d x) {
+    __mmask8 reduce = _mm512_cmp_pd_mask(x, _mm512_set1_pd(0.5), _CMP_GT_OQ);
+    __m512d reduced = _mm512_sqrt_pd(_mm512_mul_pd(_mm512_sub_pd(_mm512_set1_pd(1.0), x), _mm512_set1_pd(0.5)));
+    __m512d y = _mm512_mask_blend_pd(reduce, x, reduced);
+    __m512d z = _mm512_mul_pd(y, y);
+    __m512d r = _mm512_add_pd(y, _mm512_mul_pd(_mm512_mul_pd(y, z), hornerAvx512(kAsinPoly, z)));
+    __m512d unreduced = _mm512_sub_pd(_mm512_set1_pd(kHalfPi), _mm512_mul_pd(_mm512_set1_pd(2.0), r));
+    return _mm512_mask_blend_pd(reduce, r, unreduced);
+}
+
+__attribute__((target("avx512f")))
+static void computeDistanceRowsAvx512(const CoordColumns &c, DistanceModel model, double *distanceKm,
+                                      size_t begin, size_t end) {
+    const __m512d toRadians = _mm512_set1_pd(kRadiansPerDegree);
+    const __m512d half = _mm512_set1_pd(0.5);
+    size_t i = begin;
+    for (; i + 8 <= end; i += 8) {
+        __m512d lat1 = _mm512_loadu_pd(c.pickupLat + i);
+        __m512d lat2 = _mm512_loadu_pd(c.dropoffLat + i);
+        __m512d dLat = _mm512_mul_pd(_mm512_sub_pd(lat2, lat1), toRadians);
+        __m512d dLon = _mm512_sub_pd(_mm512_loadu_pd(c.dropoffLon + i), _mm512_loadu_pd(c.pickupLon + i));
+        __m512d turns = _mm512_roundscale_pd(_mm512_mul_pd(dLon, _mm512_set1_pd(1.0 / 360)),
+                                             _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        dLon = _mm512_mul_pd(_mm512_sub_pd(dLon, _mm512_mul_pd(_mm512_set1_pd(360.0), turns)), toRadians);
+        __m512d d;
+        if (model == DistanceModel::Equirectangular) {
+            __m512d meanLat = _mm512_mul_pd(_mm512_add_pd(lat1, lat2), _mm512_set1_pd(0.5 * kRadiansPerDegree));
+            __m512d x = _mm512_mul_pd(dLon, cosAvx512(meanLat));
+            __m512d sum = _mm512_add_pd(_mm512_mul_pd(x, x), _mm512_mul_pd(dLat, dLat));
+            d = _mm512_mul_pd(_mm512_set1_pd(kEarthRadiusKm), _mm512_sqrt_pd(sum));
+        } else {
+            __m512d sLat = sinAvx512(_mm512_mul_pd(dLat, half));
+            __m512d sLon = sinAvx512(_mm512_mul_pd(dLon, half));
+            __m512d cosProduct = _mm512_mul_pd(cosAvx512(_mm512_mul_pd(lat1, toRadians)),
+                                               cosAvx512(_mm512_mul_pd(lat2, toRadians)));
+            __m512d a = _mm512_add_pd(_mm512_mul_pd(sLat, sLat), _mm512_mul_pd(cosProduct, _mm512_mul_pd(sLon, sLon)));
+            a = _mm512_min_pd(_mm512_set1_pd(1.0), a);
+            d = _mm512_mul_pd(_mm512_set1_pd(2.0 * kEarthRadiusKm), asinAvx512(_mm512_sqrt_pd(a)));
+        }
+        _mm512_storeu_pd(distanceKm + i, d);
+    }
+    computeDistanceRowsScalar(c, model, distanceKm, i, end);
+}
+
+#pragma GCC diagnostic pop
+#endif
+
+// Fill distanceKm[0, coords.count) on the given instruction set, or scalar
+// if the CPU lacks it.  Latitudes must be in [-90, 90] and longitudes in
+// [-180, 180].
+void computeDistanceBatchWith(SimdLevel level, const CoordColumns &coords, DistanceModel model,
+                              double *distanceKm) {
+    if (level > supportedSimdLevel()) level = SimdLevel::Scalar;
+#ifdef GRAB_FARE_X86_SIMD
+    if (level == SimdLevel::Avx512) {
+        computeDistanceRowsAvx512(coords, model, distanceKm, 0, coords.count);
+        return;
+    }
+    if (level == SimdLevel::Avx2) {
+        computeDistanceRowsAvx2(coords, model, distanceKm, 0, coords.count);
+        return;
+    }
+#endif
+    computeDistanceRowsScalar(coords, model, distanceKm, 0, coords.count);
+}
+
+// Fill distanceKm on the best instruction set available
+void computeDistanceBatch(const CoordColumns &coords, DistanceModel model, double *distanceKm) {
+    computeDistanceBatchWith(supportedSimdLevel(), coords, model, distanceKm);
+}
+
+#pragma GCC pop_options
+
+// ---------------------------------------------------------------------------
+// GPS traces.  A metered trip's distance is the length of its ping trace
+// after two filters:
+//   jitter  a ping within 5 m of the last kept ping is dropped, so a parked
+//           car's wandering fix adds nothing
+//   spikes  a ping that could only be reached from the last kept ping at
+//           over 200 km/h is dropped; after three such pings in a row the
+//           trace is taken to have really moved and the third is kept
+// Every segment between consecutive pings is measured in one
+// computeDistanceBatch() pass over the point columns, offset by one.  The
+// filter then walks the pings in order, which is cheap next to the
+// trigonometry: a kept ping that follows the last kept one reuses its
+// segment, and only pings after a drop are measured again.  Kept lengths
+// are added with Kahan summation, so a trace of a million short segments
+// loses no more than one addition would.
+// ---------------------------------------------------------------------------
+
+constexpr double kTraceJitterKm = 0.005;
+constexpr double kTraceMaxSpeedKmh = 200.0;
+constexpr unsigned kTraceMaxSpikeRun = 3;
+
+// Ping columns of one or more traces; seconds only need a common origin
+// within a trace
+struct TraceColumns {
+    const double *lat;
+    const double *lon;
+    const double *seconds;
+    size_t count;
+};
+
+// Sum with a running compensation for the low bits each addition drops
+struct KahanSum {
+    double sum = 0;
+    double compensation = 0;
+
+    void add(double x) {
+        double y = x - compensation;
+        double t = sum + y;
+        compensation = (t - sum) - y;
+        sum = t;
+    }
+};
+
+// Fill segmentKm[i] with the great-circle distance from ping i to ping i + 1,
+// for every i < count - 1, on the given instruction set
+void computeTraceSegmentsWith(SimdLevel level, const TraceColumns &pings, double *segmentKm) {
+    if (pings.count < 2) return;
+    CoordColumns segments{pings.lat, pings.lon, pings.lat + 1, pings.lon + 1, pings.count - 1};
+    computeDistanceBatchWith(level, segments, DistanceModel::Haversine, segmentKm);
+}
+
+struct TraceDistance {
+    double km;
+    size_t keptPings;
+};
+
+// The filter's decision for a ping km from the last kept ping and hours
+// after it.  spikeRun counts the spikes dropped in a row since that ping.
+static inline bool keepTracePing(double km, double hours, uint8_t &spikeRun) {
+    if (km < kTraceJitterKm) return false;
+    if (km > kTraceMaxSpeedKmh * hours && ++spikeRun < kTraceMaxSpikeRun) return false;
+    spikeRun = 0;
+    return true;
+}
+
+// Filtered length of the trace in pings[first, first + count), given the
+// segment lengths computeTraceSegmentsWith() wrote for the same columns
+static TraceDistance filterTrace(const TraceColumns &pings, const double *segmentKm, size_t first, size_t count) {
+    if (count == 0) return {0, 0};
+    KahanSum total;
+    size_t kept = 1;
+    size_t anchor = first;   // last kept ping
+    uint8_t spikeRun = 0;
+    for (size_t i = first + 1; i < first + count; ++i) {
+        double km = (anchor == i - 1) ? segmentKm[anchor]
+                                      : tripDistanceKm(pings.lat[anchor], pings.lon[anchor], pings.lat[i],
+                                                       pings.lon[i], DistanceModel::Haversine);
+        double hours = (pings.seconds[i] - pings.seconds[anchor]) * (1.0 / 3600);
+        if (!keepTracePing(km, hours, spikeRun)) continue;
+        total.add(km);
+        anchor = i;
+        ++kept;
+    }
+    return {total.sum, kept};
+}
+
+// ---------------------------------------------------------------------------
+// Live fare meter.  One FareMeter follows one trip in progress: pings and
+// clock ticks update its running distance and time in O(1), and
+// breakdown() prices the totals so far, giving exactly what computeFareAt()
+// would for the same distance, time and start.  The money fields are
+// derived on read rather than accumulated per update, so they never drift
+// from the one-shot price however many updates a trip has.  Pings pass
+// through the trace filter above, so a meter fed a trace's pings in order
+// ends on the distance --trace reports for it.
+//
+// A meter allocates nothing of its own and is small enough to keep tens of
+// thousands in a flat array.  It shares ownership of the tables it was
+// started with (RateCardStore::pin() in the serve modes), so a rate card
+// reload neither frees them under it nor reprices trips already under way.
+// ---------------------------------------------------------------------------
+
+class FareMeter {
+public:
+    // Start a trip at startSeconds (Unix seconds), which fixes its peak
+    // tier.  Throws std::out_of_range for an unknown vehicle.
+    FareMeter(std::shared_ptr<const FareTables> tables, int vehicleId, double startSeconds,
+              std::string_view promoCodeRaw)
+        : tables_(std::move(tables)), startSeconds_(startSeconds) {
+        if (vehicleId < 0 || static_cast<size_t>(vehicleId) >= tables_->vehicleKnown.size() ||
+            !tables_->vehicleKnown[static_cast<size_t>(vehicleId)]) {
+            throw std::out_of_range("FareMeter: unknown vehicle id " + std::to_string(vehicleId));
+        }
+        vehicleId_ = static_cast<uint8_t>(vehicleId);
+        tier_ = tables_->calendar.tierAt(static_cast<int64_t>(std::floor(startSeconds)));
+        promoId_ = tables_->promos.find(promoCodeRaw);
+    }
+
+    // Advance the meter's clock to nowSeconds; earlier times are ignored
+    void tick(double nowSeconds) { elapsedSeconds_ = std::max(elapsedSeconds_, nowSeconds - startSeconds_); }
+
+    // Add distance measured elsewhere, such as an odometer increment
+    void addDistance(double km) { distance_.add(km); }
+
+    // Take a GPS fix: the clock moves to its time and, unless the trace
+    // filter drops it, the distance from the last kept fix is added
+    void addPing(double lat, double lon, double seconds) {
+        tick(seconds);
+        if (!hasFix_) {
+            keep(lat, lon, seconds);
+            return;
+        }
+        double km = tripDistanceKm(lastLat_, lastLon_, lat, lon, DistanceModel::Haversine);
+        if (!keepTracePing(km, (seconds - lastSeconds_) * (1.0 / 3600), spikeRun_)) return;
+        distance_.add(km);
+        keep(lat, lon, seconds);
+    }
+
+    double distanceKm() const { return distance_.sum; }
+    double timeMin() const { return elapsedSeconds_ * (1.0 / 60); }
+
+    // The fare if the trip ended now
+    GRAB_FARE_EXACT_FP
+    FareBreakdown breakdown() const {
+        return priceTrip(distanceKm(), timeMin(), tier_ != 0, tables_->ratesById[vehicleId_], promoId_,
+                         tables_->promos[promoId_], tables_->peakMultipliers[tier_], tables_->minFare);
+    }
+
+private:
+    void keep(double lat, double lon, double seconds) {
+        lastLat_ = lat;
+        lastLon_ = lon;
+        lastSeconds_ = seconds;
+        hasFix_ = true;
+    }
+
+    std::shared_ptr<const FareTables> tables_;
+    KahanSum distance_;
+    double startSeconds_;
+    double elapsedSeconds_ = 0;
+    double lastLat_ = 0, lastLon_ = 0, lastSeconds_ = 0;   // last kept fix
+    uint8_t vehicleId_ = 0;
+    uint8_t tier_ = 0;
+    uint16_t promoId_ = 0;
+    uint8_t spikeRun_ = 0;
+    bool hasFix_ = false;
+};
+static_assert(sizeof(FareMeter) <= 80, "keep FareMeter small; there is one per active trip");
+
+// ---------------------------------------------------------------------------
+// Fixed-point engine.  Money and rates are held as integer sen (1 RM = 100
+// sen), multipliers and promo percentages as basis points (1/10000),
+// distance in metres and time in seconds, so results are identical on every
+// compiler and platform.  --csv and --price-bin take this path with
+// --fixed, and --compare-fixed measures it against the double path.
+//
+// Rounding is half away from zero (all amounts are non-negative, so this is
+// "half up") and happens exactly once per field:
+//   peakBp              = round(tierBp * surgeBp / 10000)
+//                         (exact unless both have sub-percent parts)
+//   distanceCostOffPeak = round(metres * perKm / 1000)
+//   timeCost            = round(seconds * perMin / 60)
+//   distanceCostFinal   = round(metres * perKm * peakBp / (1000 * 10000))
+//                         (from the exact product, not the rounded off-peak)
+//   subtotal            = base + booking + distanceCostFinal + timeCost
+//                         (exact, so the printed lines always add up)
+//   discountApplied     = min(round(subtotal * percentageBp / 10000), cap)
+//   totalBeforeMin      = subtotal - discountApplied
+//   totalPayable        = max(totalBeforeMin, minFare)
+// Every division is by a compile-time constant, which compilers lower to a
+// multiply and shift.  Because subtotal is the sum of rounded parts the
+// result can differ from computeFare() by a sen; that is the point of a
+// single documented rounding rule.
+// ---------------------------------------------------------------------------
+
+using Sen = int64_t;
+
+constexpr int64_t kBasisPoints = 10000;   // 1.0 as a multiplier or percentage
+
+struct RatesSen {
+    Sen base;
+    Sen perKm;
+    Sen perMin;
+    Sen bookingFee;
+};
+
+struct PromoSen {
+    int64_t percentageBp;   // discount in basis points (1000 = 10%)
+    Sen cap;
+};
+
+struct FareBreakdownSen {
+    Sen base;
+    Sen booking;
+    Sen distanceCostOffPeak;
+    Sen timeCost;
+    int64_t peakMultiplierBp;   // 10000 off-peak
+    Sen distanceCostFinal;
+    Sen subtotal;
+    uint16_t promoId;
+    Sen discountApplied;
+    Sen totalBeforeMin;
+    Sen totalPayable;
+};
+
+struct FareTablesSen {
+    std::vector<RatesSen> ratesById;
+    std::vector<uint8_t> vehicleKnown;
+    std::vector<PromoSen> promos;
+    std::vector<string> promoCodes;
+    std::vector<int64_t> peakMultipliersBp;   // indexed by peak tier, 256 entries
+    Sen minFare;
+};
+
+// Divide by a positive constant, rounding half away from zero
+template <int64_t Divisor>
+static inline int64_t roundDiv(int64_t n) {
+    static_assert(Divisor > 0, "divisor must be positive");
+    return n >= 0 ? (n + Divisor / 2) / Divisor : -((Divisor / 2 - n) / Divisor);
+}
+
+// Convert a decimal amount to an integer count of 1/scale units.  Throws if
+// the value is not (within floating-point noise) a whole number of units,
+// so a rate such as RM 1.205 is rejected instead of silently rounded.
+static int64_t toFixedExact(double value, int64_t scale, const char *what) {
+    double scaled = value * static_cast<double>(scale);
+    double whole = std::round(scaled);
+    if (!(value >= 0) || std::fabs(scaled - whole) > 1e-6 ||
+        whole > static_cast<double>(std::numeric_limits<int32_t>::max())) {
+        throw std::invalid_argument(string("cannot represent ") + what + " exactly in fixed point");
+    }
+    return static_cast<int64_t>(whole);
+}
+
+// Convert the double tables to fixed point
+FareTablesSen toFixedPoint(const FareTables &tables) {
+    FareTablesSen fixed{};
+    for (const Rates &r : tables.ratesById) {
+        fixed.ratesById.push_back({toFixedExact(r.base, 100, "base fare"),
+                                   toFixedExact(r.perKm, 100, "per-km rate"),
+                                   toFixedExact(r.perMin, 100, "per-minute rate"),
+                                   toFixedExact(r.bookingFee, 100, "booking fee")});
+    }
+    fixed.vehicleKnown = tables.vehicleKnown;
+    for (size_t id = 0; id < tables.promos.size(); ++id) {
+        const Promo &p = tables.promos[id];
+        fixed.promos.push_back({toFixedExact(p.percentage, kBasisPoints, "promo percentage"),
+                                toFixedExact(p.cap, 100, "promo cap")});
+    }
+    fixed.promoCodes = tables.promos.codes();
+    for (double m : tables.peakMultipliers) {
+        fixed.peakMultipliersBp.push_back(toFixedExact(m, kBasisPoints, "peak multiplier"));
+    }
+    fixed.minFare = toFixedExact(tables.minFare, 100, "minimum fare");
+    return fixed;
+}
+
+// Quantise trip inputs (rounded half up to the nearest metre / second)
+inline int64_t metresFromKm(double km) { return std::llround(km * 1000.0); }
+inline int64_t secondsFromMin(double minutes) { return std::llround(minutes * 60.0); }
+
+// Compute the fare breakdown in integer sen for a trip in the given peak
+// tier, with an optional surge multiplier in basis points.  With distances
+// under 10,000 km, rates under RM 1,000 and multipliers under 100 no
+// intermediate comes near int64 range.  Negative distance, time or surge
+// throws std::invalid_argument and unknown vehicle ids std::out_of_range;
+// unknown promo ids mean NONE.
+FareBreakdownSen computeFareSen(int64_t distanceM, int64_t timeS, uint8_t tier,
+                                uint16_t promoId, uint8_t vehicleId,
+                                const FareTablesSen &tables, int64_t surgeBp = kBasisPoints) {
+    if (distanceM < 0 || timeS < 0 || surgeBp < 0) {
+        throw std::invalid_argument("computeFareSen: distance, time and surge must be non-negative");
+    }
+    if (vehicleId >= tables.ratesById.size() || !tables.vehicleKnown[vehicleId]) {
+        throw std::out_of_range("computeFareSen: unknown vehicle id " + std::to_string(vehicleId));
+    }
+    const RatesSen &rates = tables.ratesById[vehicleId];
+    if (promoId >= tables.promos.size()) promoId = 0;
+    const PromoSen &promo = tables.promos[promoId];
+
+    FareBreakdownSen fb{};
+    fb.base = rates.base;
+    fb.booking = rates.bookingFee;
+    int64_t distanceMilliSen = distanceM * rates.perKm;
+    fb.distanceCostOffPeak = roundDiv<1000>(distanceMilliSen);
+    fb.timeCost = roundDiv<60>(timeS * rates.perMin);
+    fb.peakMultiplierBp = roundDiv<kBasisPoints>(tables.peakMultipliersBp[tier] * surgeBp);
+    fb.distanceCostFinal = roundDiv<1000 * kBasisPoints>(distanceMilliSen * fb.peakMultiplierBp);
+    fb.subtotal = fb.base + fb.booking + fb.distanceCostFinal + fb.timeCost;
+
+    fb.promoId = promoId;
+    Sen rawDiscount = roundDiv<kBasisPoints>(fb.subtotal * promo.percentageBp);
+    fb.discountApplied = (rawDiscount > promo.cap) ? promo.cap : rawDiscount;
+
+    fb.totalBeforeMin = fb.subtotal - fb.discountApplied;
+    fb.totalPayable = (fb.totalBeforeMin < tables.minFare) ? tables.minFare : fb.totalBeforeMin;
+    return fb;
+}
+
+// Price a column set through computeFareSen(), writing the same columns as
+// computeFareBatch() (amounts as sen / 100, which prints exactly).  Rows are
+// quantised to the metre and second and surge to the basis point.  Throws
+// like computeFareSen() for a row it rejects.
+void computeFareBatch(const TripColumns &trips, const FareTablesSen &tables, const FareColumns &out) {
+    for (size_t i = 0; i < trips.count; ++i) {
+        int64_t surgeBp = trips.surge ? std::llround(trips.surge[i] * kBasisPoints) : kBasisPoints;
+        FareBreakdownSen fb = computeFareSen(metresFromKm(trips.distanceKm[i]), secondsFromMin(trips.timeMin[i]),
+                                             trips.isPeak[i], trips.promoId[i], trips.vehicleId[i], tables,
+                                             surgeBp);
+        auto put = [i](double *column, double value) {
+            if (column) column[i] = value;
+        };
+        put(out.base, static_cast<double>(fb.base) / 100);
+        put(out.booking, static_cast<double>(fb.booking) / 100);
+        put(out.distanceCostOffPeak, static_cast<double>(fb.distanceCostOffPeak) / 100);
+        put(out.timeCost, static_cast<double>(fb.timeCost) / 100);
+        put(out.peakMultiplier, static_cast<double>(fb.peakMultiplierBp) / kBasisPoints);
+        put(out.distanceCostFinal, static_cast<double>(fb.distanceCostFinal) / 100);
+        put(out.subtotal, static_cast<double>(fb.subtotal) / 100);
+        if (out.promoId) out.promoId[i] = fb.promoId;
+        put(out.discountApplied, static_cast<double>(fb.discountApplied) / 100);
+        put(out.totalBeforeMin, static_cast<double>(fb.totalBeforeMin) / 100);
+        put(out.totalPayable, static_cast<double>(fb.totalPayable) / 100);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Receipt formatting.  Breakdowns and trip summaries are rendered into a
+// TextBuffer with integer cents-to-ASCII conversion and no locale or stream
+// state, then written out in one go.  The layout is byte for byte what the
+// original iostream code printed with std::fixed << std::setprecision(2).
+// ---------------------------------------------------------------------------
+
+// Write v, already rounded to two decimals (as computeFare() returns), as
+// std::fixed << std::setprecision(2) would.  The text is built right to
+// left at the end of buf and the returned view points into it.
+static inline std::string_view formatMoney(double v, char (&buf)[32]) {
+    long long cents = std::llround(v * 100.0);
+    char *p = buf + sizeof buf;
+    bool negative = cents < 0;
+    unsigned long long u = negative ? 0ULL - static_cast<unsigned long long>(cents)
+                                    : static_cast<unsigned long long>(cents);
+    *--p = static_cast<char>('0' + u % 10); u /= 10;
+    *--p = static_cast<char>('0' + u % 10); u /= 10;
+    *--p = '.';
+    do {
+        *--p = static_cast<char>('0' + u % 10);
+        u /= 10;
+    } while (u != 0);
+    if (negative) *--p = '-';
+    return std::string_view(p, static_cast<size_t>(buf + sizeof buf - p));
+}
+
+// Growable in-memory text buffer with the same append interface as
+// BufferedWriter, for output that is built up and written in one piece
+class TextBuffer {
+public:
+    explicit TextBuffer(size_t reserve = 4096) { buf_.reserve(reserve); }
+
+    void append(const char *data, size_t n) { buf_.append(data, n); }
+    void append(std::string_view s) { buf_.append(s.data(), s.size()); }
+    void append(char c) { buf_.push_back(c); }
+
+    void appendMoney(double v) {
+        char tmp[32];
+        append(formatMoney(v, tmp));
+    }
+
+    // Shortest text that reads back as the same double
+    void appendShortest(double v) {
+        char tmp[32];
+        auto res = std::to_chars(tmp, tmp + sizeof tmp, v);
+        append(tmp, static_cast<size_t>(res.ptr - tmp));
+    }
+
+    // Any finite double, printed as std::fixed << std::setprecision(2) would.
+    // Values that are a whole number of cents take the appendMoney() path:
+    // v * 100 can only round to an integer when v is far from a half cent.
+    // Negative zero keeps its sign, so it goes the slow way.
+    void appendFixed2(double v) {
+        double cents = v * 100.0;
+        if (std::fabs(cents) < 1e15 && cents == std::nearbyint(cents) && !std::signbit(v)) {
+            appendMoney(v);
+            return;
+        }
+        char tmp[400];   // room for DBL_MAX in fixed notation
+        auto res = std::to_chars(tmp, tmp + sizeof tmp, v, std::chars_format::fixed, 2);
+        append(tmp, static_cast<size_t>(res.ptr - tmp));
+    }
+
+    std::string_view view() const { return buf_; }
+    void clear() { buf_.clear(); }
+
+    // Write the whole buffer to fd and clear it.  Throws std::runtime_error
+    // if the write fails.
+    void writeTo(int fd) {
+        const char *data = buf_.data();
+        size_t n = buf_.size();
+        while (n > 0) {
+            ssize_t written = ::write(fd, data, n);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                throw std::runtime_error(string("write failed: ") + std::strerror(errno));
+            }
+            data += written;
+            n -= static_cast<size_t>(written);
+        }
+        clear();
+    }
+
+private:
+    string buf_;
+};
+
+// Display name of a vehicle id, as shown by the menu
+static const char *vehicleDisplayName(int vehicleId) {
+    switch (vehicleId) {
+        case 1: return "GrabCar Economy";
+        case 2: return "GrabCar Premium";
+        case 3: return "GrabBike";
+        default: return "Unknown";
+    }
+}
+
+// Render the fare breakdown in a user-friendly format
+static void appendBreakdown(TextBuffer &out, const FareBreakdown &fb, const PromoTable &promos) {
+    out.append("\n--- Fare Breakdown (RM) ---\n");
+    out.append("Base fare              : ");
+    out.appendMoney(fb.base);
+    out.append("\nBooking fee            : ");
+    out.appendMoney(fb.booking);
+    out.append("\nDistance cost (off-peak): ");
+    out.appendMoney(fb.distanceCostOffPeak);
+    if (fb.peakMultiplier > 1.0) {
+        out.append("\nPeak multiplier x");
+        out.appendFixed2(fb.peakMultiplier);
+        out.append(" applied to distance\n");
+    } else {
+        out.append("\nPeak multiplier        : x1.00 (off-peak)\n");
+    }
+    out.append("Distance cost (final)  : ");
+    out.appendMoney(fb.distanceCostFinal);
+    if (fb.timeCost > 0) {
+        out.append("\nTime cost              : ");
+        out.appendMoney(fb.timeCost);
+    }
+    out.append("\nSubtotal               : ");
+    out.appendMoney(fb.subtotal);
+    out.append("\nPromo code used        : ");
+    out.append(promos.code(fb.promoId));
+    if (fb.promoId != 0) {
+        out.append(" (discount ");
+        out.appendMoney(fb.discountApplied);
+        out.append(')');
+    }
+    out.append("\nTotal before min fare  : ");
+    out.appendMoney(fb.totalBeforeMin);
+    out.append("\nMinimum fare enforced  : ");
+    out.appendMoney(fb.totalPayable);
+    out.append("\n-----------------------------\nTotal payable          : ");
+    out.appendMoney(fb.totalPayable);
+    out.append("\n\n");
+}
+
+// Render the trip summary block shown above a breakdown.  The time is only
+// shown for time-metered vehicles.
+static void appendTripSummary(TextBuffer &out, const char *vehicleName, bool isPeak, double distanceKm,
+                              double timeMin, bool showTime) {
+    out.append("\n=== Summary =================================\nVehicle: ");
+    out.append(vehicleName);
+    out.append(isPeak ? " | Peak | Distance: " : " | Off-peak | Distance: ");
+    out.appendFixed2(distanceKm);
+    out.append(" km");
+    if (showTime) {
+        out.append(" | Time: ");
+        out.appendFixed2(timeMin);
+        out.append(" min");
+    }
+    out.append("\n=============================================\n");
+}
+
+// Print the fare breakdown in a user-friendly format
+void printBreakdown(const FareBreakdown &fb, const PromoTable &promos, std::ostream &os = cout) {
+    thread_local TextBuffer text(1024);
+    text.clear();
+    appendBreakdown(text, fb, promos);
+    os.write(text.view().data(), static_cast<std::streamsize>(text.view().size()));
+    os.flush();
+}
+
+// ---------------------------------------------------------------------------
+// Latency profiling.  Each thread records into its own set of histograms,
+// one per pipeline stage, so the hot path never takes a lock or a contended
+// cache line; LatencyRegistry::merged() sums them whenever a report is
+// wanted.  Histograms are HDR-style: values below 32 ticks get exact
+// buckets, larger ones 16 linear buckets per power of two, so any recorded
+// value is reported to within about 6%.  A tick is a TSC cycle on x86 and a
+// nanosecond elsewhere.
+// ---------------------------------------------------------------------------
+
+enum class Stage : uint8_t { Parse, PromoResolve, Arithmetic, Rounding, Format };
+constexpr size_t kStageCount = 5;
+
+static const char *stageName(Stage stage) {
+    static const char *const names[kStageCount] = {"parse", "promo", "arithmetic", "rounding", "format"};
+    return names[static_cast<size_t>(stage)];
+}
+
+static inline uint64_t profileTicks() {
+#ifdef GRAB_FARE_X86_SIMD
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+// Nanoseconds per profileTicks() tick, measured once on first use
+static double nanosPerTick() {
+    static const double ratio = [] {
+#ifdef GRAB_FARE_X86_SIMD
+        auto start = std::chrono::steady_clock::now();
+        uint64_t ticks = __rdtsc();
+        std::chrono::duration<double, std::nano> elapsed{};
+        while (elapsed.count() < 20e6) elapsed = std::chrono::steady_clock::now() - start;
+        return elapsed.count() / static_cast<double>(__rdtsc() - ticks);
+#else
+        return 1.0;
+#endif
+    }();
+    return ratio;
+}
+
+class LatencyHistogram {
+public:
+    static constexpr unsigned kSubBits = 4;
+    static constexpr size_t kSubBuckets = size_t{1} << kSubBits;
+    static constexpr size_t kBuckets = (64 - kSubBits + 1) * kSubBuckets;   // top bucket holds 2^64 - 1
+
+    // Only the owning thread records; readers may merge at any time
+    void record(uint64_t ticks) {
+        std::atomic<uint64_t> &slot = counts_[bucketOf(ticks)];
+        slot.store(slot.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    void mergeFrom(const LatencyHistogram &other) {
+        for (size_t b = 0; b < kBuckets; ++b) {
+            std::atomic<uint64_t> &slot = counts_[b];
+            slot.store(slot.load(std::memory_order_relaxed) + other.counts_[b].load(std::memory_order_relaxed),
+                       std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t count() const {
+        uint64_t total = 0;
+        for (const auto &c : counts_) total += c.load(std::memory_order_relaxed);
+        return total;
+    }
+
+    // Smallest bucket upper bound covering fraction q of the samples, in ticks
+    uint64_t percentile(double q) const {
+        uint64_t total = count();
+        if (total == 0) return 0;
+        uint64_t rank = static_cast<uint64_t>(std::ceil(q * static_cast<double>(total)));
+        rank = std::max<uint64_t>(rank, 1);
+        uint64_t seen = 0;
+        for (size_t b = 0; b < kBuckets; ++b) {
+            seen += counts_[b].load(std::memory_order_relaxed);
+            if (seen >= rank) return upperBound(b);
+        }
+        return upperBound(kBuckets - 1);
+    }
+
+    uint64_t max() const { return percentile(1.0); }
+
+private:
+    static size_t bucketOf(uint64_t v) {
+        if (v < 2 * kSubBuckets) return static_cast<size_t>(v);
+        unsigned e = 63 - static_cast<unsigned>(__builtin_clzll(v));
+        return (e - kSubBits) * kSubBuckets + static_cast<size_t>(v >> (e - kSubBits));
+    }
+    static uint64_t upperBound(size_t b) {
+        if (b < 2 * kSubBuckets) return b;
+        unsigned shift = static_cast<unsigned>(b / kSubBuckets - 1);
+        uint64_t m = b % kSubBuckets + kSubBuckets;
+        return ((m + 1) << shift) - 1;
+    }
+
+    std::atomic<uint64_t> counts_[kBuckets] = {};
+};
+
+// One thread's histograms, one per stage
+struct StageRecorder {
+    LatencyHistogram stages[kStageCount];
+
+    void record(Stage stage, uint64_t startTicks, uint64_t endTicks) {
+        stages[static_cast<size_t>(stage)].record(endTicks - startTicks);
+    }
+};
+
+// Owns every thread's recorder.  Recorders outlive their threads, so counts
+// from finished workers still appear in merged().
+class LatencyRegistry {
+public:
+    static LatencyRegistry &instance() {
+        static LatencyRegistry registry;
+        return registry;
+    }
+
+    // This thread's recorder, created and registered on first use
+    StageRecorder &local() {
+        thread_local StageRecorder *recorder = nullptr;
+        if (recorder == nullptr) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            recorders_.push_back(std::make_unique<StageRecorder>());
+            recorder = recorders_.back().get();
+        }
+        return *recorder;
+    }
+
+    // Sum of every thread's histograms at this moment
+    std::unique_ptr<StageRecorder> merged() {
+        auto total = std::make_unique<StageRecorder>();
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto &r : recorders_) {
+            for (size_t s = 0; s < kStageCount; ++s) total->stages[s].mergeFrom(r->stages[s]);
+        }
+        return total;
+    }
+
+private:
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<StageRecorder>> recorders_;
+};
+
+// Print count, p50, p99, p99.9 and max per stage, in nanoseconds
+static void printLatencyReport(const StageRecorder &recorder, std::ostream &os) {
+    const double scale = nanosPerTick();
+    os << "stage            count      p50 ns      p99 ns    p99.9 ns      max ns\n";
+    for (size_t s = 0; s < kStageCount; ++s) {
+        const LatencyHistogram &h = recorder.stages[s];
+        os << std::left << std::setw(11) << stageName(static_cast<Stage>(s)) << std::right
+           << std::setw(11) << h.count() << std::fixed << std::setprecision(1);
+        for (double q : {0.50, 0.99, 0.999, 1.0}) {
+            os << std::setw(12) << static_cast<double>(h.percentile(q)) * scale;
+        }
+        os << '\n';
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Headless CSV mode.  Reads one trip per line
+//     vehicle,distance_km,time_min,peak,promo
+// (vehicle id 1-3, peak a tier or a start time, promo optional) and writes
+// one priced row per trip.  Input is read in large blocks and parsed in
+// place; rows are priced through computeFareBatch() in chunks and written
+// through one buffer.
+// Coordinate mode reads
+//     vehicle,pickup_lat,pickup_lon,dropoff_lat,dropoff_lon,time_min,peak,promo
+// instead and fills the distance column with computeDistanceBatch() once a
+// chunk is parsed, so the output is the same as for the distances.
+// ---------------------------------------------------------------------------
+
+constexpr size_t kBatchRows = 4096;
+constexpr double kMaxDistanceKm = 200.0;   // same limits as the menu prompts
+constexpr double kMaxTimeMin = 1000.0;
+constexpr uint32_t kNoCell = std::numeric_limits<uint32_t>::max();
+constexpr int64_t kNoStartTime = std::numeric_limits<int64_t>::min();
+
+// Owned column storage for a chunk of trips
+struct TripBatch {
+    std::vector<double> distanceKm;
+    std::vector<double> timeMin;
+    std::vector<uint8_t> vehicleId;
+    std::vector<uint8_t> isPeak;
+    std::vector<uint16_t> promoId;
+    std::vector<uint32_t> cell;          // surge cell, kNoCell if not given
+    std::vector<int64_t> startTime;      // unix seconds the tier came from, kNoStartTime if given as a tier
+    std::vector<size_t> lineNo;          // input line, for errors; set by CsvTripReader
+    size_t count = 0;
+
+    explicit TripBatch(size_t capacity)
+        : distanceKm(capacity), timeMin(capacity), vehicleId(capacity), isPeak(capacity),
+          promoId(capacity), cell(capacity), startTime(capacity), lineNo(capacity) {}
+
+    size_t capacity() const { return distanceKm.size(); }
+    bool full() const { return count == capacity(); }
+
+    TripColumns columns() const {
+        return {distanceKm.data(), timeMin.data(), vehicleId.data(),
+                isPeak.data(), promoId.data(), count};
+    }
+};
+
+// Trip endpoints for the rows of a TripBatch, in coordinate mode
+struct CoordBatch {
+    std::vector<double> pickupLat, pickupLon, dropoffLat, dropoffLon;
+
+    explicit CoordBatch(size_t capacity)
+        : pickupLat(capacity), pickupLon(capacity), dropoffLat(capacity), dropoffLon(capacity) {}
+
+    CoordColumns columns(size_t count) const {
+        return {pickupLat.data(), pickupLon.data(), dropoffLat.data(), dropoffLon.data(), count};
+    }
+};
+
+// Owned column storage for the priced results of a TripBatch
+struct FareBatch {
+    std::vector<double> base, booking, distanceCostOffPeak, timeCost, peakMultiplier,
+        distanceCostFinal, subtotal, discountApplied, totalBeforeMin, totalPayable;
+    std::vector<uint16_t> promoId;
+
+    explicit FareBatch(size_t capacity)
+        : base(capacity), booking(capacity), distanceCostOffPeak(capacity), timeCost(capacity),
+          peakMultiplier(capacity), distanceCostFinal(capacity), subtotal(capacity),
+          discountApplied(capacity), totalBeforeMin(capacity), totalPayable(capacity),
+          promoId(capacity) {}
+
+    FareColumns columns() {
+        return {base.data(), booking.data(), distanceCostOffPeak.data(), timeCost.data(),
+                peakMultiplier.data(), distanceCostFinal.data(), subtotal.data(), promoId.data(),
+                discountApplied.data(), totalBeforeMin.data(), totalPayable.data()};
+    }
+
+    FareBreakdown row(size_t i) const {
+        return {base[i], booking[i], distanceCostOffPeak[i], timeCost[i], peakMultiplier[i],
+                distanceCostFinal[i], subtotal[i], promoId[i], discountApplied[i], totalBeforeMin[i],
+                totalPayable[i]};
+    }
+    void setRow(size_t i, const FareBreakdown &fb) {
+        base[i] = fb.base;
+        booking[i] = fb.booking;
+        distanceCostOffPeak[i] = fb.distanceCostOffPeak;
+        timeCost[i] = fb.timeCost;
+        peakMultiplier[i] = fb.peakMultiplier;
+        distanceCostFinal[i] = fb.distanceCostFinal;
+        subtotal[i] = fb.subtotal;
+        promoId[i] = fb.promoId;
+        discountApplied[i] = fb.discountApplied;
+        totalBeforeMin[i] = fb.totalBeforeMin;
+        totalPayable[i] = fb.totalPayable;
+    }
+};
+
+// Output buffer that goes to a file descriptor in large writes
+class BufferedWriter {
+public:
+    explicit BufferedWriter(int fd, size_t capacity = 1 << 16)
+        : fd_(fd), buf_(capacity), used_(0) {}
+    ~BufferedWriter() { flush(); }
+
+    void append(const char *data, size_t n) {
+        if (n > buf_.size() - used_) {
+            flush();
+            if (n > buf_.size()) {
+                writeAll(data, n);
+                return;
+            }
+        }
+        std::memcpy(buf_.data() + used_, data, n);
+        used_ += n;
+    }
+    void append(std::string_view s) { append(s.data(), s.size()); }
+    void append(char c) {
+        if (used_ == buf_.size()) flush();
+        buf_[used_++] = c;
+    }
+
+    // Shortest text that reads back as the same double
+    void appendShortest(double v) {
+        char tmp[32];
+        auto res = std::to_chars(tmp, tmp + sizeof tmp, v);
+        append(tmp, static_cast<size_t>(res.ptr - tmp));
+    }
+
+    // A value already rounded to two decimals (as computeFare() returns),
+    // printed exactly as std::fixed << std::setprecision(2) would
+    void appendMoney(double v) {
+        char tmp[32];
+        append(formatMoney(v, tmp));
+    }
+
+    // Any finite double with two decimals, as TextBuffer::appendFixed2()
+    void appendFixed2(double v) {
+        double cents = v * 100.0;
+        if (std::fabs(cents) < 1e15 && cents == std::nearbyint(cents) && !std::signbit(v)) {
+            appendMoney(v);
+            return;
+        }
+        char tmp[400];
+        auto res = std::to_chars(tmp, tmp + sizeof tmp, v, std::chars_format::fixed, 2);
+        append(tmp, static_cast<size_t>(res.ptr - tmp));
+    }
+
+    void flush() {
+        writeAll(buf_.data(), used_);
+        used_ = 0;
+    }
+
+private:
+    void writeAll(const char *data, size_t n) {
+        while (n > 0) {
+            ssize_t written = ::write(fd_, data, n);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                throw std::runtime_error(string("write failed: ") + std::strerror(errno));
+            }
+            data += written;
+            n -= static_cast<size_t>(written);
+        }
+    }
+
+    int fd_;
+    std::vector<char> buf_;
+    size_t used_;
+};
+
+// Read-only mapping of a whole file.  Pages are faulted in on demand, so
+// parsing straight out of the mapping avoids copying into a read buffer.
+class MappedFile {
+public:
+    // Map an open descriptor; throws std::runtime_error on failure.  The
+    // descriptor can be closed once the mapping exists.
+    explicit MappedFile(int fd) {
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            throw std::runtime_error(string("fstat failed: ") + std::strerror(errno));
+        }
+        size_ = static_cast<size_t>(st.st_size);
+        if (size_ == 0) return;
+        void *p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            throw std::runtime_error(string("mmap failed: ") + std::strerror(errno));
+        }
+        data_ = static_cast<const char *>(p);
+        ::madvise(p, size_, MADV_SEQUENTIAL);
+    }
+    ~MappedFile() {
+        if (data_ != nullptr) ::munmap(const_cast<char *>(data_), size_);
+    }
+    MappedFile(MappedFile &&other) noexcept : data_(other.data_), size_(other.size_) {
+        other.data_ = nullptr;
+        other.size_ = 0;
+    }
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const char *data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    const char *data_ = nullptr;
+    size_t size_ = 0;
+};
+
+// True if the descriptor refers to a regular file that can be mapped
+static bool isRegularFile(int fd) {
+    struct stat st;
+    return ::fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+// Parse a number field, allowing surrounding whitespace
+static bool parseNumber(std::string_view field, double &out) {
+    field = trimView(field);
+    if (field.empty()) return false;
+    auto res = std::from_chars(field.data(), field.data() + field.size(), out);
+    return res.ec == std::errc() && res.ptr == field.data() + field.size();
+}
+
+// Parse one CSV trip line into the next row of the batch.  Returns nullptr
+// on success or a short reason the line was rejected.  With a recorder the
+// field parsing and promo lookup of accepted lines are timed separately.
+// With coords the line carries four coordinates in place of the distance;
+// they go to the same row of coords and the distance is left at zero.
+static const char *parseTripLine(std::string_view line, const FareTables &tables, TripBatch &batch,
+                                 StageRecorder *profile = nullptr, CoordBatch *coords = nullptr) {
+    uint64_t start = profile ? profileTicks() : 0;
+    const size_t skip = coords ? 3 : 0;   // extra leading fields
+    std::string_view fields[9];
+    size_t n = 0;
+    while (n < 6 + skip) {
+        size_t comma = line.find(',');
+        fields[n++] = line.substr(0, comma);
+        if (comma == std::string_view::npos) {
+            line = {};
+            break;
+        }
+        line.remove_prefix(comma + 1);
+    }
+    if (n < 4 + skip || !line.empty()) {
+        return coords ? "expected vehicle,pickup_lat,pickup_lon,dropoff_lat,dropoff_lon,time_min,peak[,promo[,cell]]"
+                      : "expected vehicle,distance_km,time_min,peak[,promo[,cell]]";
+    }
+
+    double vehicle, distanceKm = 0, timeMin, peak;
+    double point[4];
+    if (!parseNumber(fields[0], vehicle) || vehicle != std::floor(vehicle) || vehicle < 0 ||
+        vehicle >= static_cast<double>(tables.ratesById.size()) ||
+        !tables.vehicleKnown[static_cast<size_t>(vehicle)]) {
+        return "unknown vehicle";
+    }
+    if (coords) {
+        for (size_t k = 0; k < 4; ++k) {
+            double limit = (k % 2 == 0) ? 90 : 180;
+            if (!parseNumber(fields[1 + k], point[k]) || !(point[k] >= -limit && point[k] <= limit)) {
+                return "latitude must be in [-90, 90] and longitude in [-180, 180]";
+            }
+        }
+    } else if (!parseNumber(fields[1], distanceKm) || !(distanceKm > 0 && distanceKm <= kMaxDistanceKm)) {
+        return "distance must be in (0, 200] km";
+    }
+    if (!parseNumber(fields[2 + skip], timeMin) || !(timeMin >= 0 && timeMin <= kMaxTimeMin)) {
+        return "time must be in [0, 1000] min";
+    }
+    uint8_t tier;
+    int64_t startTime = kNoStartTime;
+    if (parseNumber(fields[3 + skip], peak) && peak == std::floor(peak) && peak >= 0 && peak <= 255) {
+        tier = static_cast<uint8_t>(peak);
+    } else if (parseTimestamp(trimView(fields[3 + skip]), tables.calendar.utcOffsetSeconds(), startTime)) {
+        tier = tables.calendar.tierAt(startTime);
+    } else {
+        return "peak must be a tier from 0 to 255 or a timestamp like 2026-10-16T08:15";
+    }
+    double cell = kNoCell;
+    if (n == 6 + skip && (!parseNumber(fields[5 + skip], cell) || cell != std::floor(cell) || cell < 0 ||
+                          cell >= kNoCell)) {
+        return "cell must be a whole number below 4294967295";
+    }
+
+    size_t row = batch.count++;
+    if (coords) {
+        coords->pickupLat[row] = point[0];
+        coords->pickupLon[row] = point[1];
+        coords->dropoffLat[row] = point[2];
+        coords->dropoffLon[row] = point[3];
+    }
+    batch.vehicleId[row] = static_cast<uint8_t>(vehicle);
+    batch.distanceKm[row] = distanceKm;
+    batch.timeMin[row] = timeMin;
+    batch.isPeak[row] = tier;
+    batch.startTime[row] = startTime;
+    batch.cell[row] = static_cast<uint32_t>(cell);
+    if (profile == nullptr) {
+        batch.promoId[row] = (n >= 5 + skip) ? tables.promos.find(fields[4 + skip]) : 0;
+        return nullptr;
+    }
+    uint64_t parsed = profileTicks();
+    batch.promoId[row] = (n >= 5 + skip) ? tables.promos.find(fields[4 + skip]) : 0;
+    profile->record(Stage::Parse, start, parsed);
+    profile->record(Stage::PromoResolve, parsed, profileTicks());
+    return nullptr;
+}
+
+static const char *const kCsvOutputHeader =
+    "vehicle,distance_km,time_min,peak,promo,base,booking,distance_offpeak,time_cost,"
+    "peak_multiplier,distance_final,subtotal,discount,total_before_min,total_payable\n";
+
+// Write row i of a priced batch as one output line, to a BufferedWriter or
+// a TextBuffer
+template <typename Out>
+static inline void appendCsvRow(Out &out, const TripBatch &batch, const FareBatch &fares,
+                                size_t i, const PromoTable &promos) {
+    out.appendShortest(batch.vehicleId[i]);
+    out.append(',');
+    out.appendShortest(batch.distanceKm[i]);
+    out.append(',');
+    out.appendShortest(batch.timeMin[i]);
+    out.append(',');
+    out.appendShortest(batch.isPeak[i]);
+    out.append(',');
+    out.append(promos.code(fares.promoId[i]));
+    out.append(',');
+    out.appendMoney(fares.base[i]);
+    out.append(',');
+    out.appendMoney(fares.booking[i]);
+    out.append(',');
+    out.appendMoney(fares.distanceCostOffPeak[i]);
+    out.append(',');
+    out.appendMoney(fares.timeCost[i]);
+    out.append(',');
+    out.appendFixed2(fares.peakMultiplier[i]);   // not a money amount; may have more decimals
+    out.append(',');
+    out.appendMoney(fares.distanceCostFinal[i]);
+    out.append(',');
+    out.appendMoney(fares.subtotal[i]);
+    out.append(',');
+    out.appendMoney(fares.discountApplied[i]);
+    out.append(',');
+    out.appendMoney(fares.totalBeforeMin[i]);
+    out.append(',');
+    out.appendMoney(fares.totalPayable[i]);
+    out.append('\n');
+}
+
+// Price the batch, through the fixed-point engine if given, and write one
+// output row per trip
+static void priceAndWriteCsv(const TripBatch &batch, FareBatch &fares, const FareTables &tables,
+                             BufferedWriter &out, const FareTablesSen *fixed = nullptr) {
+    if (fixed) {
+        computeFareBatch(batch.columns(), *fixed, fares.columns());
+    } else {
+        computeFareBatch(batch.columns(), tables, fares.columns());
+    }
+    for (size_t i = 0; i < batch.count; ++i) appendCsvRow(out, batch, fares, i, tables.promos);
+}
+
+// Same output as priceAndWriteCsv(), but one row at a time through
+// priceTrip()'s two halves so arithmetic, rounding and formatting can be
+// timed separately.  Rows come from parseTripLine(), so vehicles are known.
+GRAB_FARE_EXACT_FP
+static void priceAndWriteCsvProfiled(const TripBatch &batch, FareBatch &fares, const FareTables &tables,
+                                     BufferedWriter &out, StageRecorder &profile) {
+    for (size_t i = 0; i < batch.count; ++i) {
+        uint16_t promoId = batch.promoId[i];
+        uint64_t t0 = profileTicks();
+        FareBreakdown fb = priceTripUnrounded(batch.distanceKm[i], batch.timeMin[i], batch.isPeak[i] != 0,
+                                              tables.ratesById[batch.vehicleId[i]], promoId,
+                                              tables.promos[promoId], tables.peakMultipliers[batch.isPeak[i]], tables.minFare);
+        uint64_t t1 = profileTicks();
+        roundBreakdown(fb);
+        uint64_t t2 = profileTicks();
+        fares.base[i] = fb.base;
+        fares.booking[i] = fb.booking;
+        fares.distanceCostOffPeak[i] = fb.distanceCostOffPeak;
+        fares.timeCost[i] = fb.timeCost;
+        fares.peakMultiplier[i] = fb.peakMultiplier;
+        fares.distanceCostFinal[i] = fb.distanceCostFinal;
+        fares.subtotal[i] = fb.subtotal;
+        fares.promoId[i] = fb.promoId;
+        fares.discountApplied[i] = fb.discountApplied;
+        fares.totalBeforeMin[i] = fb.totalBeforeMin;
+        fares.totalPayable[i] = fb.totalPayable;
+        appendCsvRow(out, batch, fares, i, tables.promos);
+        uint64_t t3 = profileTicks();
+        profile.record(Stage::Arithmetic, t0, t1);
+        profile.record(Stage::Rounding, t1, t2);
+        profile.record(Stage::Format, t2, t3);
+    }
+}
+
+// Feed CSV text through the parser one line at a time, handing each full
+// batch of parsed rows to a callback.  The first line is treated as a
+// header and skipped if its vehicle field is not a number.
+class CsvTripReader {
+public:
+    // The handler may write to the batch; it is cleared once the handler returns
+    using BatchHandler = std::function<void(TripBatch &)>;
+
+    // With a recorder, parse and promo lookup times are recorded per line
+    CsvTripReader(const FareTables &tables, BatchHandler onBatch, StageRecorder *profile = nullptr)
+        : tables_(tables), onBatch_(std::move(onBatch)), batch_(kBatchRows), profile_(profile) {}
+
+    // Parse every complete line in [begin, end); returns how many bytes were
+    // consumed.  With atEof the last line need not end in a newline.
+    size_t consume(const char *begin, const char *end, bool atEof) {
+        const char *p = begin;
+        while (p < end) {
+            const char *nl = static_cast<const char *>(std::memchr(p, '\n', static_cast<size_t>(end - p)));
+            if (nl == nullptr && !atEof) break;
+            const char *lineEnd = nl ? nl : end;
+            handleLine(std::string_view(p, static_cast<size_t>(lineEnd - p)));
+            p = nl ? nl + 1 : end;
+        }
+        return static_cast<size_t>(p - begin);
+    }
+
+    // Read coordinate lines from now on, measuring each trip with the model
+    void readCoordinates(DistanceModel model) {
+        coords_ = std::make_unique<CoordBatch>(kBatchRows);
+        model_ = model;
+    }
+
+    // Hand over whatever is left in the current batch
+    void finish() {
+        if (coords_ && batch_.count > 0) measureDistances();
+        if (batch_.count > 0) {
+            onBatch_(batch_);
+            batch_.count = 0;
+        }
+    }
+
+    size_t rejected() const { return rejected_; }
+
+private:
+    // Fill the distance column from the coordinates, then drop the trips
+    // whose distance is out of range, keeping the rest in order
+    void measureDistances() {
+        computeDistanceBatch(coords_->columns(batch_.count), model_, batch_.distanceKm.data());
+        size_t kept = 0;
+        for (size_t i = 0; i < batch_.count; ++i) {
+            double d = batch_.distanceKm[i];
+            if (!(d > 0 && d <= kMaxDistanceKm)) {
+                ++rejected_;
+                std::cerr << "line " << batch_.lineNo[i] << ": distance must be in (0, 200] km\n";
+                continue;
+            }
+            if (kept != i) {
+                batch_.distanceKm[kept] = d;
+                batch_.timeMin[kept] = batch_.timeMin[i];
+                batch_.vehicleId[kept] = batch_.vehicleId[i];
+                batch_.isPeak[kept] = batch_.isPeak[i];
+                batch_.promoId[kept] = batch_.promoId[i];
+                batch_.cell[kept] = batch_.cell[i];
+                batch_.startTime[kept] = batch_.startTime[i];
+                batch_.lineNo[kept] = batch_.lineNo[i];
+            }
+            ++kept;
+        }
+        batch_.count = kept;
+    }
+
+    void handleLine(std::string_view line) {
+        ++lineNo_;
+        if (trimView(line).empty()) return;
+        if (lineNo_ == 1) {
+            double ignored;
+            size_t comma = line.find(',');
+            if (!parseNumber(line.substr(0, comma), ignored)) return;
+        }
+        const char *error = parseTripLine(line, tables_, batch_, profile_, coords_.get());
+        if (error != nullptr) {
+            ++rejected_;
+            std::cerr << "line " << lineNo_ << ": " << error << '\n';
+            return;
+        }
+        batch_.lineNo[batch_.count - 1] = lineNo_;
+        if (batch_.full()) finish();
+    }
+
+    const FareTables &tables_;
+    BatchHandler onBatch_;
+    TripBatch batch_;
+    StageRecorder *profile_;
+    std::unique_ptr<CoordBatch> coords_;   // set in coordinate mode
+    DistanceModel model_ = DistanceModel::Haversine;
+    size_t lineNo_ = 0;
+    size_t rejected_ = 0;
+};
+
+// Read CSV from a stream that cannot be mapped (pipe, terminal) in large
+// blocks, carrying any partial last line over to the next block
+template <typename Reader>
+static bool readCsvStream(int fd, Reader &reader) {
+    std::vector<char> buf(1 << 20);
+    size_t filled = 0;
+    while (true) {
+        if (filled == buf.size()) buf.resize(buf.size() * 2);   // a single huge line
+        ssize_t got = ::read(fd, buf.data() + filled, buf.size() - filled);
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "read failed: " << std::strerror(errno) << '\n';
+            return false;
+        }
+        filled += static_cast<size_t>(got);
+        bool atEof = (got == 0);
+        size_t used = reader.consume(buf.data(), buf.data() + filled, atEof);
+        std::memmove(buf.data(), buf.data() + used, filled - used);
+        filled -= used;
+        if (atEof) return true;
+    }
+}
+
+// Run a CSV file (or stdin when path is null or "-") through the reader, a
+// CsvTripReader or anything else with its consume() and finish().  Regular
+// files, including a redirected stdin, are memory-mapped and parsed in
+// place.  Returns false if the input could not be opened or read.
+template <typename Reader>
+static bool readCsvInput(const char *path, Reader &reader) {
+    int fd = STDIN_FILENO;
+    if (path != nullptr && std::strcmp(path, "-") != 0) {
+        fd = ::open(path, O_RDONLY);
+        if (fd < 0) {
+            std::cerr << "cannot open " << path << ": " << std::strerror(errno) << '\n';
+            return false;
+        }
+    }
+    bool ok = true;
+    if (isRegularFile(fd)) {
+        try {
+            MappedFile file(fd);
+            reader.consume(file.data(), file.data() + file.size(), true);
+        } catch (const std::runtime_error &e) {
+            std::cerr << e.what() << '\n';
+            ok = false;
+        }
+    } else {
+        ok = readCsvStream(fd, reader);
+    }
+    reader.finish();
+    if (fd != STDIN_FILENO) ::close(fd);
+    return ok;
+}
+
+// Price a CSV file (or stdin) to stdout.  With profile set, every stage of
+// every row is timed and a latency report goes to stderr at the end; with
+// fixed set, trips are priced by the fixed-point engine (the two do not
+// combine).  Returns the process exit status: 0 on success, 1 if the input
+// could not be read, the rate card has no exact fixed-point form or any
+// line was rejected.
+int runCsvMode(const FareTables &tables, const char *path, bool profile = false, bool fixed = false) {
+    std::unique_ptr<FareTablesSen> tablesSen;
+    if (fixed) {
+        try {
+            tablesSen = std::make_unique<FareTablesSen>(toFixedPoint(tables));
+        } catch (const std::invalid_argument &e) {
+            std::cerr << e.what() << '\n';
+            return 1;
+        }
+    }
+    BufferedWriter out(STDOUT_FILENO);
+    out.append(kCsvOutputHeader);
+    FareBatch fares(kBatchRows);
+    StageRecorder *recorder = profile ? &LatencyRegistry::instance().local() : nullptr;
+    CsvTripReader reader(tables, [&](const TripBatch &batch) {
+        if (recorder) {
+            priceAndWriteCsvProfiled(batch, fares, tables, out, *recorder);
+        } else {
+            priceAndWriteCsv(batch, fares, tables, out, tablesSen.get());
+        }
+    }, recorder);
+    bool ok = readCsvInput(path, reader);
+    out.flush();
+    if (recorder) printLatencyReport(*LatencyRegistry::instance().merged(), std::cerr);
+    return (!ok || reader.rejected() > 0) ? 1 : 0;
+}
+
+// Price CSV trips (from a file or stdin) through both the double and the
+// fixed-point engine and report how far apart the money fields come out.
+// The two round differently (see the fixed-point engine) but must stay
+// within kMaxFixedDriftSen of each other; returns 1 if any row does not,
+// the input could not be read, a line was rejected or the rate card has
+// no exact fixed-point form.
+constexpr int64_t kMaxFixedDriftSen = 2;
+
+int runCompareFixedMode(const FareTables &tables, const char *path) {
+    FareTablesSen tablesSen;
+    try {
+        tablesSen = toFixedPoint(tables);
+    } catch (const std::invalid_argument &e) {
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
+    FareBatch asDouble(kBatchRows), asSen(kBatchRows);
+    uint64_t rows = 0, differing = 0, beyond = 0;
+    int64_t maxDrift = 0;
+    CsvTripReader reader(tables, [&](const TripBatch &batch) {
+        computeFareBatch(batch.columns(), tables, asDouble.columns());
+        computeFareBatch(batch.columns(), tablesSen, asSen.columns());
+        for (size_t i = 0; i < batch.count; ++i) {
+            FareBreakdown a = asDouble.row(i), b = asSen.row(i);
+            int64_t drift = 0;
+            for (auto field : {&FareBreakdown::base, &FareBreakdown::booking, &FareBreakdown::distanceCostOffPeak,
+                               &FareBreakdown::timeCost, &FareBreakdown::distanceCostFinal,
+                               &FareBreakdown::subtotal, &FareBreakdown::discountApplied,
+                               &FareBreakdown::totalBeforeMin, &FareBreakdown::totalPayable}) {
+                int64_t sen = static_cast<int64_t>(std::llabs(std::llround(a.*field * 100) - std::llround(b.*field * 100)));
+                drift = std::max(drift, sen);
+            }
+            ++rows;
+            differing += drift > 0;
+            beyond += drift > kMaxFixedDriftSen;
+            maxDrift = std::max(maxDrift, drift);
+        }
+    });
+    bool ok = readCsvInput(path, reader);
+    cout << "rows: " << rows << ", differing: " << differing << ", max drift: " << maxDrift
+         << " sen, beyond " << kMaxFixedDriftSen << " sen: " << beyond << '\n';
+    return (!ok || reader.rejected() > 0 || beyond > 0) ? 1 : 0;
+}
+
+// Price CSV trips given as pickup and drop-off coordinates (from a file or
+// stdin), measuring each with the model.  Output and exit status are those
+// of runCsvMode(), with the computed distance in the distance_km column.
+int runCoordsMode(const FareTables &tables, const char *path, DistanceModel model) {
+    BufferedWriter out(STDOUT_FILENO);
+    out.append(kCsvOutputHeader);
+    FareBatch fares(kBatchRows);
+    CsvTripReader reader(tables, [&](const TripBatch &batch) { priceAndWriteCsv(batch, fares, tables, out); });
+    reader.readCoordinates(model);
+    bool ok = readCsvInput(path, reader);
+    out.flush();
+    return (!ok || reader.rejected() > 0) ? 1 : 0;
+}
+
+// Print a full receipt (summary block and breakdown, as the interactive
+// calculator shows them) for every trip in a CSV file or stdin.  Each batch
+// is rendered into one buffer and written with a single write().  Returns
+// the same exit status as runCsvMode().
+int runReceiptsMode(const FareTables &tables, const char *path) {
+    FareBatch fares(kBatchRows);
+    TextBuffer text(kBatchRows * 768);
+    bool writeFailed = false;
+    CsvTripReader reader(tables, [&](const TripBatch &batch) {
+        if (writeFailed) return;
+        computeFareBatch(batch.columns(), tables, fares.columns());
+        for (size_t i = 0; i < batch.count; ++i) {
+            uint8_t vehicle = batch.vehicleId[i];
+            FareBreakdown fb{fares.base[i], fares.booking[i], fares.distanceCostOffPeak[i], fares.timeCost[i],
+                             fares.peakMultiplier[i], fares.distanceCostFinal[i], fares.subtotal[i],
+                             fares.promoId[i], fares.discountApplied[i], fares.totalBeforeMin[i],
+                             fares.totalPayable[i]};
+            appendTripSummary(text, vehicleDisplayName(vehicle), batch.isPeak[i] != 0, batch.distanceKm[i],
+                              batch.timeMin[i], tables.ratesById[vehicle].perMin > 0);
+            appendBreakdown(text, fb, tables.promos);
+        }
+        try {
+            text.writeTo(STDOUT_FILENO);
+        } catch (const std::runtime_error &e) {
+            std::cerr << e.what() << '\n';
+            writeFailed = true;
+        }
+    });
+    bool ok = readCsvInput(path, reader);
+    return (!ok || writeFailed || reader.rejected() > 0) ? 1 : 0;
+}
+
+// Collect GPS pings, one per line
+//     trip,vehicle,time,lat,lon[,promo]
+// into traces of consecutive lines with the same trip id, then measure and
+// price them.  time is Unix seconds or a timestamp like parseTripLine()
+// takes; vehicle, promo and the peak tier come from a trace's first ping.
+// Pings of many traces are buffered so their segments are measured in one
+// pass, and priced trips are handed over in batches.
+class TraceReader {
+public:
+    struct Row {
+        std::string trip;
+        size_t pings;
+        size_t keptPings;
+    };
+    using BatchHandler = std::function<void(const TripBatch &, const std::vector<Row> &)>;
+
+    TraceReader(const FareTables &tables, BatchHandler onBatch)
+        : tables_(tables), onBatch_(std::move(onBatch)), batch_(kBatchRows), rows_(kBatchRows) {}
+
+    // Parse every complete line in [begin, end); returns how many bytes were
+    // consumed.  With atEof the last line need not end in a newline.
+    size_t consume(const char *begin, const char *end, bool atEof) {
+        const char *p = begin;
+        while (p < end) {
+            const char *nl = static_cast<const char *>(std::memchr(p, '\n', static_cast<size_t>(end - p)));
+            if (nl == nullptr && !atEof) break;
+            const char *lineEnd = nl ? nl : end;
+            handleLine(std::string_view(p, static_cast<size_t>(lineEnd - p)));
+            p = nl ? nl + 1 : end;
+        }
+        return static_cast<size_t>(p - begin);
+    }
+
+    // Measure and hand over every trace still buffered
+    void finish() {
+        measure();
+        if (batch_.count > 0) {
+            onBatch_(batch_, rows_);
+            batch_.count = 0;
+        }
+    }
+
+    // Rejected pings and traces
+    size_t rejected() const { return rejected_; }
+
+private:
+    static constexpr size_t kBufferedPings = size_t{1} << 16;
+
+    struct Trace {
+        std::string trip;
+        size_t first;
+        size_t count;
+        size_t lineNo;
+        uint8_t vehicleId;
+        uint8_t tier;
+        uint16_t promoId;
+    };
+
+    void reject(const char *error) {
+        ++rejected_;
+        std::cerr << "line " << lineNo_ << ": " << error << '\n';
+    }
+
+    void handleLine(std::string_view line) {
+        ++lineNo_;
+        if (trimView(line).empty()) return;
+        std::string_view fields[6];
+        size_t n = 0;
+        while (n < 6) {
+            size_t comma = line.find(',');
+            fields[n++] = line.substr(0, comma);
+            if (comma == std::string_view::npos) {
+                line = {};
+                break;
+            }
+            line.remove_prefix(comma + 1);
+        }
+        double vehicle, seconds, lat, lon;
+        bool vehicleIsNumber = n >= 2 && parseNumber(fields[1], vehicle);
+        if (lineNo_ == 1 && !vehicleIsNumber) return;   // header
+        if (n < 5 || !line.empty()) return reject("expected trip,vehicle,time,lat,lon[,promo]");
+
+        std::string_view trip = trimView(fields[0]);
+        if (trip.empty()) return reject("missing trip id");
+        int64_t unixSeconds;
+        if (parseTimestamp(trimView(fields[2]), tables_.calendar.utcOffsetSeconds(), unixSeconds)) {
+            seconds = static_cast<double>(unixSeconds);
+        } else if (!parseNumber(fields[2], seconds) || !std::isfinite(seconds)) {
+            return reject("time must be Unix seconds or a timestamp like 2026-10-16T08:15:30");
+        }
+        if (!parseNumber(fields[3], lat) || !(lat >= -90 && lat <= 90) || !parseNumber(fields[4], lon) ||
+            !(lon >= -180 && lon <= 180)) {
+            return reject("latitude must be in [-90, 90] and longitude in [-180, 180]");
+        }
+
+        bool sameTrace = !traces_.empty() && traces_.back().trip == trip;
+        if (sameTrace) {
+            if (seconds < seconds_.back()) return reject("time goes backwards within the trace");
+        } else {
+            if (!vehicleIsNumber || vehicle != std::floor(vehicle) || vehicle < 0 ||
+                vehicle >= static_cast<double>(tables_.ratesById.size()) ||
+                !tables_.vehicleKnown[static_cast<size_t>(vehicle)]) {
+                return reject("unknown vehicle");
+            }
+            if (lat_.size() >= kBufferedPings) measure();
+            traces_.push_back({string(trip), lat_.size(), 0, lineNo_, static_cast<uint8_t>(vehicle),
+                               tables_.calendar.tierAt(static_cast<int64_t>(std::floor(seconds))),
+                               n == 6 ? tables_.promos.find(fields[5]) : uint16_t{0}});
+        }
+        lat_.push_back(lat);
+        lon_.push_back(lon);
+        seconds_.push_back(seconds);
+        ++traces_.back().count;
+    }
+
+    // Measure every buffered trace, queue the ones in range for pricing and
+    // empty the buffers
+    void measure() {
+        TraceColumns pings{lat_.data(), lon_.data(), seconds_.data(), lat_.size()};
+        segmentKm_.resize(pings.count);
+        computeTraceSegmentsWith(supportedSimdLevel(), pings, segmentKm_.data());
+        for (const Trace &t : traces_) {
+            TraceDistance d = filterTrace(pings, segmentKm_.data(), t.first, t.count);
+            double timeMin = (seconds_[t.first + t.count - 1] - seconds_[t.first]) * (1.0 / 60);
+            const char *error = nullptr;
+            if (!(d.km > 0 && d.km <= kMaxDistanceKm)) error = "distance must be in (0, 200] km";
+            else if (timeMin > kMaxTimeMin) error = "time must be in [0, 1000] min";
+            if (error != nullptr) {
+                ++rejected_;
+                std::cerr << "trip " << t.trip << " (line " << t.lineNo << "): " << error << '\n';
+                continue;
+            }
+            size_t row = batch_.count++;
+            batch_.distanceKm[row] = d.km;
+            batch_.timeMin[row] = timeMin;
+            batch_.vehicleId[row] = t.vehicleId;
+            batch_.isPeak[row] = t.tier;
+            batch_.promoId[row] = t.promoId;
+            batch_.cell[row] = kNoCell;
+            rows_[row].trip = t.trip;
+            rows_[row].pings = t.count;
+            rows_[row].keptPings = d.keptPings;
+            if (batch_.full()) {
+                onBatch_(batch_, rows_);
+                batch_.count = 0;
+            }
+        }
+        traces_.clear();
+        lat_.clear();
+        lon_.clear();
+        seconds_.clear();
+    }
+
+    const FareTables &tables_;
+    BatchHandler onBatch_;
+    TripBatch batch_;
+    std::vector<Row> rows_;              // labels for the rows of batch_
+    std::vector<double> lat_, lon_, seconds_, segmentKm_;
+    std::vector<Trace> traces_;          // buffered; the last may still grow
+    size_t lineNo_ = 0;
+    size_t rejected_ = 0;
+};
+
+// Price GPS traces from a file or stdin to stdout: one row per trip with its
+// ping counts followed by the columns runCsvMode() writes, the distance
+// being the filtered trace length.  Returns 0 on success, 1 if the input
+// could not be read or any ping or trace was rejected.
+int runTraceMode(const FareTables &tables, const char *path) {
+    BufferedWriter out(STDOUT_FILENO);
+    out.append("trip,pings,kept_pings,");
+    out.append(kCsvOutputHeader);
+    FareBatch fares(kBatchRows);
+    TraceReader reader(tables, [&](const TripBatch &batch, const std::vector<TraceReader::Row> &rows) {
+        computeFareBatch(batch.columns(), tables, fares.columns());
+        for (size_t i = 0; i < batch.count; ++i) {
+            out.append(rows[i].trip);
+            out.append(',');
+            out.appendShortest(static_cast<double>(rows[i].pings));
+            out.append(',');
+            out.appendShortest(static_cast<double>(rows[i].keptPings));
+            out.append(',');
+            appendCsvRow(out, batch, fares, i, tables.promos);
+        }
+    });
+    bool ok = readCsvInput(path, reader);
+    out.flush();
+    return (!ok || reader.rejected() > 0) ? 1 : 0;
+}
+
+// ---------------------------------------------------------------------------
+// Binary columnar files.  A trip file (magic GRABTRP1) holds the input
+// columns; a fare file (GRABFAR1) holds priced results in the same row
+// order.  Both share one layout, all little-endian and mmap-able as is:
+//
+//   ColumnarHeader                      64 bytes
+//   ColumnEntry[columnCount]            id, element size, byte offset
+//   promo dictionary                    promoCount x 16-byte codes, NUL padded
+//   column data                         one typed array per column, each
+//                                       starting on a 64-byte boundary
+//
+// Promo codes are stored once in the dictionary and rows carry a uint16
+// index into it, so no column needs parsing.  The peak column holds tier
+// indexes of the rate card the trips were packed with (see FareTables);
+// tiers above 1 only mean the same multiplier under that card, and the
+// file does not record which card it was.
+// ---------------------------------------------------------------------------
+
+constexpr char kTripFileMagic[8] = {'G', 'R', 'A', 'B', 'T', 'R', 'P', '1'};
+constexpr char kFareFileMagic[8] = {'G', 'R', 'A', 'B', 'F', 'A', 'R', '1'};
+constexpr uint32_t kColumnarVersion = 1;
+constexpr uint32_t kByteOrderMark = 0x01020304;   // reads back differently on big-endian
+constexpr size_t kColumnAlign = 64;
+constexpr size_t kPromoCodeWidth = kPromoKeyWidth;
+constexpr size_t kMaxColumns = 16;
+
+struct ColumnarHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t rowCount;
+    uint32_t columnCount;
+    uint32_t promoCount;
+    uint64_t dictionaryOffset;
+    uint8_t reserved[24];
+};
+static_assert(sizeof(ColumnarHeader) == 64, "header is 64 bytes on disk");
+
+struct ColumnEntry {
+    uint32_t columnId;
+    uint32_t elementSize;
+    uint64_t offset;
+};
+static_assert(sizeof(ColumnEntry) == 16, "column entry is 16 bytes on disk");
+
+enum ColumnId : uint32_t {
+    kColDistanceKm = 1,
+    kColTimeMin,
+    kColVehicleId,
+    kColIsPeak,
+    kColPromoId,
+    kColBase = 16,
+    kColBooking,
+    kColDistanceCostOffPeak,
+    kColTimeCost,
+    kColPeakMultiplier,
+    kColDistanceCostFinal,
+    kColSubtotal,
+    kColDiscountApplied,
+    kColTotalBeforeMin,
+    kColTotalPayable,
+};
+
+struct ColumnSpec {
+    uint32_t columnId;
+    uint32_t elementSize;
+};
+
+static const ColumnSpec kTripFileColumns[] = {
+    {kColDistanceKm, 8}, {kColTimeMin, 8}, {kColVehicleId, 1}, {kColIsPeak, 1}, {kColPromoId, 2},
+};
+
+static const ColumnSpec kFareFileColumns[] = {
+    {kColBase, 8}, {kColBooking, 8}, {kColDistanceCostOffPeak, 8}, {kColTimeCost, 8},
+    {kColPeakMultiplier, 8}, {kColDistanceCostFinal, 8}, {kColSubtotal, 8}, {kColPromoId, 2},
+    {kColDiscountApplied, 8}, {kColTotalBeforeMin, 8}, {kColTotalPayable, 8},
+};
+
+static size_t alignUp(size_t n, size_t align) { return (n + align - 1) / align * align; }
+
+// Columnar file created at its final size and mapped read-write, so callers
+// fill the columns in place
+class ColumnarWriter {
+public:
+    // Throws std::runtime_error if the file cannot be created or mapped, and
+    // std::invalid_argument if a promo code is longer than 16 bytes
+    template <size_t N>
+    ColumnarWriter(const char *path, const char (&magic)[8], const ColumnSpec (&columns)[N],
+                   uint64_t rowCount, const std::vector<string> &promoCodes) {
+        static_assert(N <= kMaxColumns, "too many columns");
+        size_t dictionaryOffset = sizeof(ColumnarHeader) + N * sizeof(ColumnEntry);
+        size_t offset = alignUp(dictionaryOffset + promoCodes.size() * kPromoCodeWidth, kColumnAlign);
+        ColumnEntry entries[N];
+        for (size_t c = 0; c < N; ++c) {
+            entries[c] = {columns[c].columnId, columns[c].elementSize, offset};
+            offset = alignUp(offset + rowCount * columns[c].elementSize, kColumnAlign);
+        }
+        size_ = offset;
+
+        int fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            throw std::runtime_error(string("cannot create ") + path + ": " + std::strerror(errno));
+        }
+        if (::ftruncate(fd, static_cast<off_t>(size_)) != 0) {
+            int err = errno;
+            ::close(fd);
+            throw std::runtime_error(string("cannot size ") + path + ": " + std::strerror(err));
+        }
+        void *p = ::mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) {
+            throw std::runtime_error(string("mmap failed: ") + std::strerror(errno));
+        }
+        data_ = static_cast<char *>(p);
+
+        ColumnarHeader header{};
+        std::memcpy(header.magic, magic, sizeof header.magic);
+        header.version = kColumnarVersion;
+        header.byteOrder = kByteOrderMark;
+        header.rowCount = rowCount;
+        header.columnCount = static_cast<uint32_t>(N);
+        header.promoCount = static_cast<uint32_t>(promoCodes.size());
+        header.dictionaryOffset = dictionaryOffset;
+        std::memcpy(data_, &header, sizeof header);
+        std::memcpy(data_ + sizeof header, entries, sizeof entries);
+        for (size_t i = 0; i < promoCodes.size(); ++i) {
+            if (promoCodes[i].size() > kPromoCodeWidth) {
+                throw std::invalid_argument("promo code longer than 16 bytes: " + promoCodes[i]);
+            }
+            std::memcpy(data_ + dictionaryOffset + i * kPromoCodeWidth,
+                        promoCodes[i].data(), promoCodes[i].size());
+        }
+        std::memcpy(entries_, entries, sizeof entries);
+        columnCount_ = N;
+    }
+    ~ColumnarWriter() {
+        if (data_ != nullptr) ::munmap(data_, size_);
+    }
+    ColumnarWriter(const ColumnarWriter &) = delete;
+    ColumnarWriter &operator=(const ColumnarWriter &) = delete;
+
+    template <typename T>
+    T *column(uint32_t columnId) {
+        for (size_t c = 0; c < columnCount_; ++c) {
+            if (entries_[c].columnId == columnId && entries_[c].elementSize == sizeof(T)) {
+                return reinterpret_cast<T *>(data_ + entries_[c].offset);
+            }
+        }
+        throw std::logic_error("column not in this file layout");
+    }
+
+private:
+    char *data_ = nullptr;
+    size_t size_ = 0;
+    ColumnEntry entries_[kMaxColumns];
+    size_t columnCount_ = 0;
+};
+
+// Read-only view of a columnar file.  Validation checks the header and that
+// every column lies inside the file; after that columns are used in place.
+class ColumnarReader {
+public:
+    // Throws std::runtime_error if the file is missing, truncated or not a
+    // columnar file with the expected magic
+    ColumnarReader(const char *path, const char (&magic)[8]) : file_(openFile(path)) {
+        const string where = string(path) + ": ";
+        if (file_.size() < sizeof(ColumnarHeader)) {
+            throw std::runtime_error(where + "too short for a columnar header");
+        }
+        std::memcpy(&header_, file_.data(), sizeof header_);
+        if (std::memcmp(header_.magic, magic, sizeof header_.magic) != 0) {
+            throw std::runtime_error(where + "wrong file type (magic " + string(magic, 8) + " expected)");
+        }
+        if (header_.byteOrder != kByteOrderMark) {
+            throw std::runtime_error(where + "written on a machine with different byte order");
+        }
+        if (header_.version != kColumnarVersion) {
+            throw std::runtime_error(where + "unsupported version " + std::to_string(header_.version));
+        }
+        if (header_.columnCount > kMaxColumns) {
+            throw std::runtime_error(where + "too many columns (" + std::to_string(header_.columnCount) + ")");
+        }
+        // Every bound is checked as a quotient of the space left, so a
+        // hostile rowCount or offset cannot wrap the arithmetic around
+        const uint64_t size = file_.size();
+        uint64_t directoryEnd = sizeof(ColumnarHeader) + uint64_t{header_.columnCount} * sizeof(ColumnEntry);
+        if (directoryEnd > size || header_.dictionaryOffset > size ||
+            header_.promoCount > (size - header_.dictionaryOffset) / kPromoCodeWidth) {
+            throw std::runtime_error(where + "truncated directory or dictionary");
+        }
+        entries_ = reinterpret_cast<const ColumnEntry *>(file_.data() + sizeof(ColumnarHeader));
+        for (uint32_t c = 0; c < header_.columnCount; ++c) {
+            const ColumnEntry &e = entries_[c];
+            if (e.offset % kColumnAlign != 0 || e.elementSize == 0 || e.elementSize > 8 || e.offset > size ||
+                header_.rowCount > (size - e.offset) / e.elementSize) {
+                throw std::runtime_error(where + "column " + std::to_string(e.columnId) + " out of bounds");
+            }
+        }
+    }
+
+    uint64_t rowCount() const { return header_.rowCount; }
+
+    // Promo dictionary, decoded (it is tiny)
+    std::vector<string> promoCodes() const {
+        std::vector<string> codes;
+        const char *dict = file_.data() + header_.dictionaryOffset;
+        for (uint32_t i = 0; i < header_.promoCount; ++i) {
+            const char *code = dict + i * kPromoCodeWidth;
+            codes.emplace_back(code, strnlen(code, kPromoCodeWidth));
+        }
+        return codes;
+    }
+
+    // Column data, or a std::runtime_error if the file lacks the column
+    template <typename T>
+    const T *column(uint32_t columnId) const {
+        for (uint32_t c = 0; c < header_.columnCount; ++c) {
+            if (entries_[c].columnId == columnId && entries_[c].elementSize == sizeof(T)) {
+                return reinterpret_cast<const T *>(file_.data() + entries_[c].offset);
+            }
+        }
+        throw std::runtime_error("missing column " + std::to_string(columnId));
+    }
+
+private:
+    static MappedFile openFile(const char *path) {
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error(string("cannot open ") + path + ": " + std::strerror(errno));
+        }
+        try {
+            MappedFile file(fd);
+            ::close(fd);
+            return file;
+        } catch (...) {
+            ::close(fd);
+            throw;
+        }
+    }
+
+    MappedFile file_;
+    ColumnarHeader header_{};
+    const ColumnEntry *entries_ = nullptr;
+};
+
+// Convert a CSV trip file into a columnar trip file
+int runPackMode(const FareTables &tables, const char *inPath, const char *outPath) {
+    std::vector<double> distanceKm, timeMin;
+    std::vector<uint8_t> vehicleId, isPeak;
+    std::vector<uint16_t> promoId;
+    CsvTripReader reader(tables, [&](const TripBatch &batch) {
+        distanceKm.insert(distanceKm.end(), batch.distanceKm.begin(), batch.distanceKm.begin() + batch.count);
+        timeMin.insert(timeMin.end(), batch.timeMin.begin(), batch.timeMin.begin() + batch.count);
+        vehicleId.insert(vehicleId.end(), batch.vehicleId.begin(), batch.vehicleId.begin() + batch.count);
+        isPeak.insert(isPeak.end(), batch.isPeak.begin(), batch.isPeak.begin() + batch.count);
+        promoId.insert(promoId.end(), batch.promoId.begin(), batch.promoId.begin() + batch.count);
+    });
+    if (!readCsvInput(inPath, reader)) return 1;
+
+    try {
+        size_t rows = distanceKm.size();
+        ColumnarWriter out(outPath, kTripFileMagic, kTripFileColumns, rows, tables.promos.codes());
+        std::copy(distanceKm.begin(), distanceKm.end(), out.column<double>(kColDistanceKm));
+        std::copy(timeMin.begin(), timeMin.end(), out.column<double>(kColTimeMin));
+        std::copy(vehicleId.begin(), vehicleId.end(), out.column<uint8_t>(kColVehicleId));
+        std::copy(isPeak.begin(), isPeak.end(), out.column<uint8_t>(kColIsPeak));
+        std::copy(promoId.begin(), promoId.end(), out.column<uint16_t>(kColPromoId));
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
+    return reader.rejected() > 0 ? 1 : 0;
+}
+
+// Trip columns of a mapped trip file.  If the file's promo dictionary does
+// not match the tables, promo ids are translated into promoStorage.
+static TripColumns tripColumnsOf(const ColumnarReader &in, const FareTables &tables,
+                                 std::vector<uint16_t> &promoStorage) {
+    TripColumns trips{in.column<double>(kColDistanceKm), in.column<double>(kColTimeMin),
+                      in.column<uint8_t>(kColVehicleId), in.column<uint8_t>(kColIsPeak),
+                      in.column<uint16_t>(kColPromoId), static_cast<size_t>(in.rowCount())};
+    std::vector<string> fileCodes = in.promoCodes();
+    if (fileCodes != tables.promos.codes()) {
+        std::vector<uint16_t> remap(fileCodes.size());
+        for (size_t i = 0; i < fileCodes.size(); ++i) remap[i] = tables.promos.find(fileCodes[i]);
+        promoStorage.resize(trips.count);
+        for (size_t i = 0; i < trips.count; ++i) {
+            uint16_t id = trips.promoId[i];
+            promoStorage[i] = id < remap.size() ? remap[id] : 0;
+        }
+        trips.promoId = promoStorage.data();
+    }
+    return trips;
+}
+
+// Output columns of a fare file being written
+static FareColumns fareColumnsOf(ColumnarWriter &out) {
+    return {out.column<double>(kColBase), out.column<double>(kColBooking),
+            out.column<double>(kColDistanceCostOffPeak), out.column<double>(kColTimeCost),
+            out.column<double>(kColPeakMultiplier), out.column<double>(kColDistanceCostFinal),
+            out.column<double>(kColSubtotal), out.column<uint16_t>(kColPromoId),
+            out.column<double>(kColDiscountApplied), out.column<double>(kColTotalBeforeMin),
+            out.column<double>(kColTotalPayable)};
+}
+
+// ---------------------------------------------------------------------------
+// Parallel batch pricing.  Rows are cut into fixed-size chunks and each
+// worker starts with a contiguous run of chunk indices, held as one atomic
+// word (first << 32 | end).  A worker takes chunks from the front of its own
+// run; when it runs dry it steals the back half of another worker's run with
+// a single compare-and-swap.  Chunks cover disjoint rows, so workers write
+// disjoint output ranges and nothing is locked.
+// ---------------------------------------------------------------------------
+
+constexpr size_t kParallelChunkRows = 16384;
+
+// Rows [begin, begin + count) of a column set
+static TripColumns sliceTrips(const TripColumns &trips, size_t begin, size_t count) {
+    return {trips.distanceKm + begin, trips.timeMin + begin, trips.vehicleId + begin,
+            trips.isPeak + begin, trips.promoId + begin, count, trips.surge ? trips.surge + begin : nullptr};
+}
+
+static FareColumns sliceFares(const FareColumns &out, size_t begin) {
+    auto at = [begin](auto *column) { return column ? column + begin : column; };
+    return {at(out.base), at(out.booking), at(out.distanceCostOffPeak), at(out.timeCost),
+            at(out.peakMultiplier), at(out.distanceCostFinal), at(out.subtotal), at(out.promoId),
+            at(out.discountApplied), at(out.totalBeforeMin), at(out.totalPayable)};
+}
+
+class ChunkScheduler {
+public:
+    ChunkScheduler(size_t chunkCount, unsigned workers) : runs_(workers) {
+        for (unsigned w = 0; w < workers; ++w) {
+            uint64_t first = chunkCount * w / workers;
+            uint64_t end = chunkCount * (w + 1) / workers;
+            runs_[w].word.store(pack(first, end), std::memory_order_relaxed);
+        }
+    }
+
+    // Next chunk for this worker, taken from its own run or stolen.  Returns
+    // false once every run is empty.
+    bool next(unsigned self, uint64_t &chunk) {
+        while (true) {
+            if (takeFront(self, chunk)) return true;
+            if (!stealInto(self)) return false;
+        }
+    }
+
+private:
+    struct alignas(64) Run {
+        std::atomic<uint64_t> word{0};
+    };
+
+    static uint64_t pack(uint64_t first, uint64_t end) { return first << 32 | end; }
+
+    bool takeFront(unsigned self, uint64_t &chunk) {
+        std::atomic<uint64_t> &word = runs_[self].word;
+        uint64_t w = word.load(std::memory_order_acquire);
+        while ((w >> 32) < (w & 0xFFFFFFFFu)) {
+            if (word.compare_exchange_weak(w, w + (uint64_t{1} << 32), std::memory_order_acq_rel)) {
+                chunk = w >> 32;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Move the back half of some other run into ours.  A run only loses
+    // chunks, so if every victim looks empty the work is all taken (anything
+    // in flight between a thief's steal and its store is that thief's).
+    bool stealInto(unsigned self) {
+        const unsigned n = static_cast<unsigned>(runs_.size());
+        for (unsigned k = 1; k < n; ++k) {
+            std::atomic<uint64_t> &victim = runs_[(self + k) % n].word;
+            uint64_t w = victim.load(std::memory_order_acquire);
+            while (true) {
+                uint64_t first = w >> 32, end = w & 0xFFFFFFFFu;
+                if (first >= end) break;
+                uint64_t split = end - (end - first + 1) / 2;
+                if (victim.compare_exchange_weak(w, pack(first, split), std::memory_order_acq_rel)) {
+                    runs_[self].word.store(pack(split, end), std::memory_order_release);
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    std::vector<Run> runs_;
+};
+
+// Run fn(chunk) for every chunk in [0, chunkCount) on the given number of
+// threads (at least one).  If any call throws, the remaining workers stop
+// early and the first error is rethrown after they have all joined.
+template <typename Fn>
+static void runChunks(size_t chunkCount, unsigned threads, Fn &&fn) {
+    if (chunkCount > 0xFFFFFFFFu) throw std::length_error("too many chunks");
+    threads = static_cast<unsigned>(std::min<size_t>(std::max(threads, 1u), std::max<size_t>(chunkCount, 1)));
+    ChunkScheduler scheduler(chunkCount, threads);
+    std::atomic<bool> failed{false};
+    std::vector<std::exception_ptr> errors(threads);
+    auto work = [&](unsigned self) {
+        try {
+            uint64_t chunk;
+            while (!failed.load(std::memory_order_relaxed) && scheduler.next(self, chunk)) {
+                fn(static_cast<size_t>(chunk));
+            }
+        } catch (...) {
+            errors[self] = std::current_exception();
+            failed.store(true, std::memory_order_relaxed);
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < threads; ++t) pool.emplace_back(work, t);
+    work(0);
+    for (auto &th : pool) th.join();
+    for (auto &error : errors) {
+        if (error) std::rethrow_exception(error);
+    }
+}
+
+// Price a column set on the given number of threads (0 = one per core).
+// Gives the same results as computeFareBatch(); if any row has an unknown
+// vehicle id the first such error is rethrown after all workers stop.
+// Tables is FareTables, or FareTablesSen for the fixed-point engine.
+template <typename Tables>
+void computeFareParallel(const TripColumns &trips, const Tables &tables,
+                         const FareColumns &out, unsigned threads = 0,
+                         size_t chunkRows = kParallelChunkRows) {
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t chunkCount = (trips.count + chunkRows - 1) / chunkRows;
+    if (threads <= 1 || chunkCount <= 1) {
+        computeFareBatch(trips, tables, out);
+        return;
+    }
+    runChunks(chunkCount, threads, [&](size_t chunk) {
+        size_t begin = chunk * chunkRows;
+        size_t count = std::min(chunkRows, trips.count - begin);
+        computeFareBatch(sliceTrips(trips, begin, count), tables, sliceFares(out, begin));
+    });
+}
+
+// Time computeFareParallel() on a trip file from one thread up to
+// maxThreads (0 = one per core) and print the scaling table
+int runScalingMode(const FareTables &tables, const char *inPath, unsigned maxThreads) {
+    if (maxThreads == 0) maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    try {
+        ColumnarReader in(inPath, kTripFileMagic);
+        std::vector<uint16_t> promoStorage;
+        TripColumns trips = tripColumnsOf(in, tables, promoStorage);
+        FareBatch fares(trips.count);
+        FareColumns out = fares.columns();
+        computeFareParallel(trips, tables, out, maxThreads);   // warm page cache and output
+
+        std::vector<unsigned> counts;
+        for (unsigned t = 1; t < maxThreads; t *= 2) counts.push_back(t);
+        counts.push_back(maxThreads);
+
+        cout << "rows: " << trips.count << ", simd: " << simdLevelName(detectSimdLevel()) << '\n';
+        cout << "threads  seconds   Mtrips/s  speedup\n";
+        double baseline = 0;
+        for (unsigned t : counts) {
+            double best = std::numeric_limits<double>::max();
+            for (int rep = 0; rep < 3; ++rep) {
+                auto start = std::chrono::steady_clock::now();
+                computeFareParallel(trips, tables, out, t);
+                std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+                best = std::min(best, elapsed.count());
+            }
+            if (t == 1) baseline = best;
+            cout << std::setw(7) << t << std::fixed << std::setprecision(4) << std::setw(9) << best
+                 << std::setprecision(1) << std::setw(11) << trips.count / best / 1e6
+                 << std::setprecision(2) << std::setw(9) << baseline / best << "x\n";
+        }
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
+    return 0;
+}
+
+// Price a columnar trip file into a columnar fare file on every core.  Both
+// files are mapped, so the kernels read and write the file pages directly.
+// With fixed set the fixed-point engine prices the trips.
+int runPriceBinMode(const FareTables &tables, const char *inPath, const char *outPath, bool fixed = false) {
+    try {
+        std::unique_ptr<FareTablesSen> tablesSen;
+        if (fixed) tablesSen = std::make_unique<FareTablesSen>(toFixedPoint(tables));
+        ColumnarReader in(inPath, kTripFileMagic);
+        std::vector<uint16_t> promoStorage;
+        TripColumns trips = tripColumnsOf(in, tables, promoStorage);
+        ColumnarWriter out(outPath, kFareFileMagic, kFareFileColumns, trips.count, tables.promos.codes());
+        if (tablesSen) {
+            computeFareParallel(trips, *tablesSen, fareColumnsOf(out));
+        } else {
+            computeFareParallel(trips, tables, fareColumnsOf(out));
+        }
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
+    return 0;
+}
+
+// Print a columnar trip or fare file as CSV
+int runDumpMode(const char *path) {
+    try {
+        char magic[8] = {};
+        {
+            int fd = ::open(path, O_RDONLY);
+            if (fd < 0 || ::read(fd, magic, sizeof magic) != static_cast<ssize_t>(sizeof magic)) {
+                if (fd >= 0) ::close(fd);
+                throw std::runtime_error(string("cannot read ") + path);
+            }
+            ::close(fd);
+        }
+        BufferedWriter out(STDOUT_FILENO);
+        if (std::memcmp(magic, kTripFileMagic, sizeof magic) == 0) {
+            ColumnarReader in(path, kTripFileMagic);
+            std::vector<string> codes = in.promoCodes();
+            const double *distanceKm = in.column<double>(kColDistanceKm);
+            const double *timeMin = in.column<double>(kColTimeMin);
+            const uint8_t *vehicleId = in.column<uint8_t>(kColVehicleId);
+            const uint8_t *isPeak = in.column<uint8_t>(kColIsPeak);
+            const uint16_t *promoId = in.column<uint16_t>(kColPromoId);
+            out.append("vehicle,distance_km,time_min,peak,promo\n");
+            for (uint64_t i = 0; i < in.rowCount(); ++i) {
+                out.appendShortest(vehicleId[i]);
+                out.append(',');
+                out.appendShortest(distanceKm[i]);
+                out.append(',');
+                out.appendShortest(timeMin[i]);
+                out.append(',');
+                out.appendShortest(isPeak[i]);
+                out.append(',');
+                out.append(promoId[i] < codes.size() ? codes[promoId[i]] : string("NONE"));
+                out.append('\n');
+            }
+        } else {
+            ColumnarReader in(path, kFareFileMagic);
+            std::vector<string> codes = in.promoCodes();
+            static const uint32_t moneyColumns[] = {
+                kColBase, kColBooking, kColDistanceCostOffPeak, kColTimeCost, kColPeakMultiplier,
+                kColDistanceCostFinal, kColSubtotal, kColDiscountApplied, kColTotalBeforeMin,
+                kColTotalPayable};
+            const double *money[10];
+            for (size_t c = 0; c < 10; ++c) money[c] = in.column<double>(moneyColumns[c]);
+            const uint16_t *promoId = in.column<uint16_t>(kColPromoId);
+            out.append("promo,base,booking,distance_offpeak,time_cost,peak_multiplier,"
+                       "distance_final,subtotal,discount,total_before_min,total_payable\n");
+            for (uint64_t i = 0; i < in.rowCount(); ++i) {
+                out.append(promoId[i] < codes.size() ? codes[promoId[i]] : string("NONE"));
+                for (size_t c = 0; c < 10; ++c) {
+                    out.append(',');
+                    if (moneyColumns[c] == kColPeakMultiplier) {
+                        out.appendFixed2(money[c][i]);
+                    } else {
+                        out.appendMoney(money[c][i]);
+                    }
+                }
+                out.append('\n');
+            }
+        }
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Rate cards.  A RateCard is everything pricing depends on: vehicle rates,
+// promo codes, the peak multiplier and the minimum fare.  The built-in card
+// is what main() used to hard-code; --rates FILE loads one from a text file
+// instead:
+//
+//     # comments run to the end of the line
+//     peak_multiplier 1.50
+//     min_fare 5.00
+//     vehicle 1 base 2.50 per_km 1.20 per_min 0.20 booking 1.00
+//     promo GRAB10 percentage 0.10 cap 3.00
+//
+// --compile-rates turns such a file into a binary snapshot that loads
+// without parsing; --rates accepts either.  rates.conf in the source tree is
+// the built-in card in this format.
+//
+// Long-running modes keep the FareTables built from a card in a
+// RateCardStore, which swaps in a new card on SIGHUP while pricing threads
+// go on reading the old one without locks (see RateCardStore).
+// ---------------------------------------------------------------------------
+
+// Peak hours on some days.  Later windows override earlier ones where they
+// overlap.
+struct PeakWindow {
+    uint8_t days;           // bit 0 Monday .. bit 6 Sunday, bit 7 holidays
+    int startSlot, endSlot; // fifteen-minute slots of the day, [start, end)
+    double multiplier;      // 0 means the card's peak_multiplier
+};
+
+struct RateCard {
+    std::map<int, Rates> vehicles;
+    std::map<string, Promo> promos;
+    double peakMultiplier;
+    double minFare;
+    int32_t utcOffsetSeconds = 8 * 3600;
+    std::vector<PeakWindow> peakWindows;
+    std::vector<int64_t> holidays;      // days since 1970-01-01
+};
+
+// Rates shipped with the calculator, also in rates.conf.  These values
+// roughly reflect real-world Grab fares in Malaysia (update them as needed).
+RateCard defaultRateCard() {
+    RateCard card;
+    card.vehicles = {
+        {1, {2.50, 1.20, 0.20, 1.00}},  // GrabCar Economy
+        {2, {4.00, 1.60, 0.30, 1.00}},  // GrabCar Premium
+        {3, {1.50, 0.50, 0.00, 0.50}}   // GrabBike
+    };
+    card.promos = {
+        {"NONE",      {0.00, 0.00}},
+        {"GRAB10",    {0.10, 3.00}}, // 10% off up to RM3
+        {"STUDENT15", {0.15, 5.00}}, // 15% off up to RM5
+        {"SUPER20",   {0.20, 8.00}}  // 20% off up to RM8
+    };
+    card.peakMultiplier = 1.50; // 50% surcharge on distance cost
+    card.minFare = 5.00;        // Minimum payable fare
+    card.peakWindows = {
+        {0x1f, 7 * 4, 10 * 4, 0},   // weekday mornings
+        {0x1f, 17 * 4, 20 * 4, 0}   // weekday evenings
+    };
+    for (const char *date : {"2026-01-01", "2026-05-01", "2026-08-31", "2026-09-16", "2026-12-25"}) {
+        int64_t day;
+        parseDate(date, day);
+        card.holidays.push_back(day);
+    }
+    return card;
+}
+
+// The card's peak windows as a PeakCalendar, with the multiplier of each
+// tier it uses.  Tier 1 is always peak_multiplier; other multipliers get
+// tiers from 2 up.  Throws std::invalid_argument if more than 255 tiers
+// would be needed.
+static PeakCalendar buildPeakCalendar(const RateCard &card, std::vector<double> &peakMultipliers) {
+    peakMultipliers.assign(256, card.peakMultiplier);
+    peakMultipliers[0] = 1.0;
+    std::vector<double> used = {1.0, card.peakMultiplier};
+    uint8_t tiers[PeakCalendar::kRows][PeakCalendar::kSlotsPerDay] = {};
+    for (const PeakWindow &w : card.peakWindows) {
+        double multiplier = w.multiplier == 0 ? card.peakMultiplier : w.multiplier;
+        size_t tier = std::find(used.begin(), used.end(), multiplier) - used.begin();
+        if (tier == used.size()) {
+            if (tier == 256) throw std::invalid_argument("more than 254 distinct peak multipliers");
+            used.push_back(multiplier);
+            peakMultipliers[tier] = multiplier;
+        }
+        for (int row = 0; row < PeakCalendar::kRows; ++row) {
+            if ((w.days >> row & 1) == 0) continue;
+            std::fill(tiers[row] + w.startSlot, tiers[row] + w.endSlot, static_cast<uint8_t>(tier));
+        }
+    }
+
+    std::vector<int64_t> days = card.holidays;
+    std::sort(days.begin(), days.end());
+    std::vector<uint64_t> bits;
+    int64_t first = days.empty() ? 0 : days.front();
+    if (!days.empty()) bits.resize(static_cast<size_t>((days.back() - first) / 64 + 1));
+    for (int64_t day : days) bits[static_cast<size_t>((day - first) / 64)] |= uint64_t{1} << ((day - first) % 64);
+    return PeakCalendar(card.utcOffsetSeconds, &tiers[0][0], first, std::move(bits));
+}
+
+FareTables buildFareTables(const RateCard &card) {
+    FareTables tables = buildFareTables(card.vehicles, card.promos, card.peakMultiplier, card.minFare);
+    tables.calendar = buildPeakCalendar(card, tables.peakMultipliers);
+    return tables;
+}
+
+// 0 for "mon" .. 6 for "sun", 7 for "holiday", -1 otherwise
+static int dayOfWeek(std::string_view name) {
+    static const char *const kNames[] = {"mon", "tue", "wed", "thu", "fri", "sat", "sun", "holiday"};
+    for (int d = 0; d < 8; ++d) {
+        if (name == kNames[d]) return d;
+    }
+    return -1;
+}
+
+// Slot of HH:MM on a quarter hour, 00:00 to 24:00, or -1
+static int quarterHour(std::string_view text) {
+    if (text.size() != 5 || text[2] != ':') return -1;
+    for (size_t i : {0, 1, 3, 4}) {
+        if (text[i] < '0' || text[i] > '9') return -1;
+    }
+    int minutes = ((text[0] - '0') * 10 + (text[1] - '0')) * 60 + (text[3] - '0') * 10 + (text[4] - '0');
+    if (text[3] > '5' || minutes % 15 != 0 || minutes > 24 * 60) return -1;
+    return minutes / 15;
+}
+
+// Parse rate-card text.  origin names the source in error messages.
+// Throws std::invalid_argument with the line number of the first problem.
+RateCard parseRateCard(std::string_view text, const string &origin) {
+    RateCard card;
+    bool havePeak = false, haveMinFare = false;
+    size_t lineNo = 0;
+    while (!text.empty()) {
+        size_t nl = text.find('\n');
+        std::string_view line = text.substr(0, nl);
+        text.remove_prefix(nl == std::string_view::npos ? text.size() : nl + 1);
+        ++lineNo;
+        line = line.substr(0, line.find('#'));
+
+        std::vector<std::string_view> words;
+        while (true) {
+            line = trimView(line);
+            if (line.empty()) break;
+            size_t end = line.find_first_of(" \t\r");
+            words.push_back(line.substr(0, end));
+            line.remove_prefix(end == std::string_view::npos ? line.size() : end);
+        }
+        if (words.empty()) continue;
+
+        auto fail = [&](const string &what) {
+            throw std::invalid_argument(origin + ":" + std::to_string(lineNo) + ": " + what);
+        };
+        auto number = [&](std::string_view word, double lo, double hi) {
+            double v;
+            if (!parseNumber(word, v) || !(v >= lo && v <= hi)) {
+                char bounds[64];
+                char *end = std::to_chars(bounds, bounds + 30, lo).ptr;
+                *end++ = ',';
+                *end++ = ' ';
+                end = std::to_chars(end, bounds + sizeof bounds, hi).ptr;
+                fail("'" + string(word) + "' is not a number in [" + string(bounds, end) + "]");
+            }
+            return v;
+        };
+        // "key value" pairs after the first fixedWords words, all required
+        auto fields = [&](size_t fixedWords, std::initializer_list<const char *> keys) {
+            std::vector<double> values(keys.size());
+            std::vector<bool> seen(keys.size(), false);
+            if ((words.size() - fixedWords) != 2 * keys.size()) {
+                string expected;
+                for (const char *k : keys) expected += string(" ") + k + " N";
+                fail("expected" + expected);
+            }
+            for (size_t w = fixedWords; w < words.size(); w += 2) {
+                size_t k = 0;
+                for (const char *key : keys) {
+                    if (words[w] == key) break;
+                    ++k;
+                }
+                if (k == keys.size() || seen[k]) fail("unexpected or repeated '" + string(words[w]) + "'");
+                seen[k] = true;
+                values[k] = number(words[w + 1], 0, 1e6);
+            }
+            return values;
+        };
+
+        std::string_view keyword = words[0];
+        if (keyword == "peak_multiplier" && words.size() == 2) {
+            card.peakMultiplier = number(words[1], 1, 100);
+            havePeak = true;
+        } else if (keyword == "min_fare" && words.size() == 2) {
+            card.minFare = number(words[1], 0, 1e6);
+            haveMinFare = true;
+        } else if (keyword == "vehicle" && words.size() >= 2) {
+            int id = static_cast<int>(number(words[1], 0, 255));
+            if (id != number(words[1], 0, 255)) fail("vehicle id must be a whole number");
+            if (card.vehicles.count(id)) fail("vehicle " + std::to_string(id) + " defined twice");
+            std::vector<double> v = fields(2, {"base", "per_km", "per_min", "booking"});
+            card.vehicles[id] = Rates{v[0], v[1], v[2], v[3]};
+        } else if (keyword == "timezone" && words.size() == 2) {
+            if (!parseUtcOffset(words[1], card.utcOffsetSeconds)) {
+                fail("timezone must be a UTC offset like +08:00, at most 14 hours");
+            }
+        } else if (keyword == "peak" && (words.size() == 3 || words.size() == 4)) {
+            PeakWindow w{0, 0, 0, words.size() == 4 ? number(words[3], 1, 100) : 0};
+            for (std::string_view list = words[1]; !list.empty();) {
+                size_t comma = list.find(',');
+                std::string_view range = list.substr(0, comma);
+                list.remove_prefix(comma == std::string_view::npos ? list.size() : comma + 1);
+                size_t dash = range.find('-');
+                int from = dayOfWeek(range.substr(0, dash));
+                int to = dash == std::string_view::npos ? from : dayOfWeek(range.substr(dash + 1));
+                if (from < 0 || to < 0 || (from == 7) != (to == 7) || to < from) {
+                    fail("days must be like mon-fri, sat,sun or holiday");
+                }
+                for (int d = from; d <= to; ++d) w.days |= static_cast<uint8_t>(1 << d);
+            }
+            std::string_view hours = words[2];
+            size_t dash = hours.find('-');
+            w.startSlot = quarterHour(hours.substr(0, dash));
+            w.endSlot = dash == std::string_view::npos ? -1 : quarterHour(hours.substr(dash + 1));
+            if (w.startSlot < 0 || w.endSlot < 0 || w.endSlot <= w.startSlot) {
+                fail("hours must be like 07:00-10:00, on quarter hours, ending after they start");
+            }
+            card.peakWindows.push_back(w);
+        } else if (keyword == "holiday" && words.size() == 2) {
+            int64_t day;
+            if (!parseDate(words[1], day)) fail("holiday must be a date like 2026-08-31");
+            card.holidays.push_back(day);
+        } else if (keyword == "promo" && words.size() >= 2) {
+            string code(words[1]);
+            if (card.promos.count(code)) fail("promo " + code + " defined twice");
+            std::vector<double> v = fields(2, {"percentage", "cap"});
+            if (v[0] > 1) fail("percentage is a fraction between 0 and 1");
+            card.promos[code] = Promo{v[0], v[1]};
+        } else {
+            fail("unknown or malformed line '" + string(words[0]) + " ...'");
+        }
+    }
+    if (card.vehicles.empty()) throw std::invalid_argument(origin + ": no vehicles defined");
+    if (!havePeak) throw std::invalid_argument(origin + ": peak_multiplier missing");
+    if (!haveMinFare) throw std::invalid_argument(origin + ": min_fare missing");
+    return card;
+}
+
+// Compiled rate cards.  --compile-rates turns a rate-card file into a
+// snapshot of the FareTables built from it, promo hash index included, so
+// loading one is a map, a validation pass and a copy: no text is parsed and
+// no hash is searched for.  Little-endian, each array on a 64-byte boundary:
+//
+//   RateCardFileHeader                 128 bytes
+//   Rates[vehicleSlots]                indexed by vehicle id
+//   uint8_t[vehicleSlots]              1 if the vehicle is defined
+//   Promo[promoCount]                  indexed by promo id
+//   PromoKey[promoCount]               folded codes, NUL padded
+//   PromoTable::Slot[slotCount]        hash-and-displace slots
+//   uint16_t[bucketCount]              bucket displacements
+//   double[256]                        multiplier of each peak tier
+//   uint8_t[8][96]                     PeakCalendar tiers
+//   uint64_t[holidayWords]             PeakCalendar holiday bits
+//
+// The arrays are copied out of the mapping (a few KB) rather than used in
+// place, so the file can be closed and the tables swapped like any other.
+
+constexpr char kRateCardMagic[8] = {'G', 'R', 'A', 'B', 'R', 'C', 'S', '1'};
+constexpr uint32_t kRateCardVersion = 2;
+
+struct RateCardFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    double peakMultiplier;
+    double minFare;
+    uint32_t vehicleSlots;
+    uint32_t promoCount;
+    uint32_t slotCount;
+    uint32_t bucketCount;
+    uint64_t fileSize;
+    uint64_t checksum;      // of everything after the header
+    int32_t utcOffsetSeconds;
+    uint32_t holidayWords;
+    int64_t firstHoliday;
+    char reserved[48];      // zero
+};
+static_assert(sizeof(RateCardFileHeader) == 128, "header is 128 bytes on disk");
+static_assert(sizeof(Rates) == 32 && sizeof(Promo) == 16 && sizeof(PromoKey) == 16 &&
+                  sizeof(PromoTable::Slot) == 24 && offsetof(PromoTable::Slot, id) == 16,
+              "compiled rate cards store these structs as they are in memory");
+
+struct RateCardLayout {
+    size_t rates, known, promos, keys, slots, displacement, multipliers, tiers, holidays, size;
+};
+
+static RateCardLayout rateCardLayout(const RateCardFileHeader &h) {
+    RateCardLayout l;
+    l.rates = sizeof h;
+    l.known = alignUp(l.rates + size_t{h.vehicleSlots} * sizeof(Rates), 64);
+    l.promos = alignUp(l.known + h.vehicleSlots, 64);
+    l.keys = alignUp(l.promos + size_t{h.promoCount} * sizeof(Promo), 64);
+    l.slots = alignUp(l.keys + size_t{h.promoCount} * sizeof(PromoKey), 64);
+    l.displacement = alignUp(l.slots + size_t{h.slotCount} * sizeof(PromoTable::Slot), 64);
+    l.multipliers = alignUp(l.displacement + size_t{h.bucketCount} * sizeof(uint16_t), 64);
+    l.tiers = l.multipliers + 256 * sizeof(double);
+    l.holidays = l.tiers + PeakCalendar::kRows * PeakCalendar::kSlotsPerDay;
+    l.size = alignUp(l.holidays + size_t{h.holidayWords} * sizeof(uint64_t), 64);
+    return l;
+}
+
+static uint64_t rateCardChecksum(const char *data, size_t size) {
+    uint64_t h = size;
+    for (size_t i = 0; i + 8 <= size; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, data + i, 8);
+        h = mix64(h ^ word);
+    }
+    return h;
+}
+
+// Write tables as a compiled rate card.  The file is written under a
+// temporary name and renamed into place, so a server reloading it on
+// SIGHUP never sees half of one.  Throws std::runtime_error on I/O failure.
+static void writeCompiledRateCard(const FareTables &tables, const char *path) {
+    const PromoTable &promos = tables.promos;
+    RateCardFileHeader h{};
+    std::memcpy(h.magic, kRateCardMagic, sizeof h.magic);
+    h.version = kRateCardVersion;
+    h.byteOrder = kByteOrderMark;
+    h.peakMultiplier = tables.peakMultiplier;
+    h.minFare = tables.minFare;
+    h.vehicleSlots = static_cast<uint32_t>(tables.ratesById.size());
+    h.promoCount = static_cast<uint32_t>(promos.size());
+    h.slotCount = static_cast<uint32_t>(promos.slots().size());
+    h.bucketCount = static_cast<uint32_t>(promos.displacements().size());
+    h.utcOffsetSeconds = tables.calendar.utcOffsetSeconds();
+    h.holidayWords = static_cast<uint32_t>(tables.calendar.holidayBits().size());
+    h.firstHoliday = tables.calendar.firstHoliday();
+    RateCardLayout l = rateCardLayout(h);
+    h.fileSize = l.size;
+
+    string image(l.size, '\0');   // padding stays zero, so the checksum is reproducible
+    char *p = &image[0];
+    std::memcpy(p + l.rates, tables.ratesById.data(), tables.ratesById.size() * sizeof(Rates));
+    std::memcpy(p + l.known, tables.vehicleKnown.data(), tables.vehicleKnown.size());
+    for (size_t id = 0; id < promos.size(); ++id) {
+        std::memcpy(p + l.promos + id * sizeof(Promo), &promos[id], sizeof(Promo));
+    }
+    std::memcpy(p + l.keys, promos.keys().data(), promos.size() * sizeof(PromoKey));
+    for (size_t s = 0; s < promos.slots().size(); ++s) {
+        const PromoTable::Slot &slot = promos.slots()[s];
+        char *at = p + l.slots + s * sizeof(PromoTable::Slot);
+        std::memcpy(at, &slot.key, sizeof slot.key);
+        std::memcpy(at + offsetof(PromoTable::Slot, id), &slot.id, sizeof slot.id);
+    }
+    std::memcpy(p + l.displacement, promos.displacements().data(), h.bucketCount * sizeof(uint16_t));
+    std::memcpy(p + l.multipliers, tables.peakMultipliers.data(), 256 * sizeof(double));
+    std::memcpy(p + l.tiers, tables.calendar.tiers(), l.holidays - l.tiers);
+    std::memcpy(p + l.holidays, tables.calendar.holidayBits().data(), h.holidayWords * sizeof(uint64_t));
+    h.checksum = rateCardChecksum(p + sizeof h, l.size - sizeof h);
+    std::memcpy(p, &h, sizeof h);
+    TextBuffer file;
+    file.append(image);
+
+    string temporary = string(path) + ".tmp";
+    int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) throw std::runtime_error("cannot create " + temporary + ": " + std::strerror(errno));
+    try {
+        file.writeTo(fd);
+        if (::fsync(fd) != 0) throw std::runtime_error(string("fsync failed: ") + std::strerror(errno));
+    } catch (...) {
+        ::close(fd);
+        ::unlink(temporary.c_str());
+        throw;
+    }
+    ::close(fd);
+    if (::rename(temporary.c_str(), path) != 0) {
+        int err = errno;
+        ::unlink(temporary.c_str());
+        throw std::runtime_error(string("cannot rename into ") + path + ": " + std::strerror(err));
+    }
+}
+
+// Tables from a mapped compiled rate card.  Every value is checked against
+// the limits a rate-card file has, so a corrupt or hand-made snapshot is
+// rejected rather than priced with.  Throws std::runtime_error.
+static FareTables loadCompiledRateCard(const char *data, size_t size, const string &path) {
+    const string where = path + ": ";
+    RateCardFileHeader h;
+    if (size < sizeof h) throw std::runtime_error(where + "too short for a compiled rate card");
+    std::memcpy(&h, data, sizeof h);
+    if (h.byteOrder != kByteOrderMark) {
+        throw std::runtime_error(where + "written on a machine with different byte order");
+    }
+    if (h.version != kRateCardVersion) {
+        throw std::runtime_error(where + "unsupported version " + std::to_string(h.version));
+    }
+    if (h.vehicleSlots == 0 || h.vehicleSlots > 256 || h.fileSize != size ||
+        rateCardLayout(h).size != size) {
+        throw std::runtime_error(where + "truncated or malformed compiled rate card");
+    }
+    if (rateCardChecksum(data + sizeof h, size - sizeof h) != h.checksum) {
+        throw std::runtime_error(where + "checksum mismatch");
+    }
+    RateCardLayout l = rateCardLayout(h);
+    auto inRange = [](double v, double lo, double hi) { return v >= lo && v <= hi; };
+
+    FareTables tables{};
+    tables.peakMultiplier = h.peakMultiplier;
+    tables.minFare = h.minFare;
+    tables.ratesById.resize(h.vehicleSlots);
+    tables.vehicleKnown.resize(h.vehicleSlots);
+    std::memcpy(tables.ratesById.data(), data + l.rates, h.vehicleSlots * sizeof(Rates));
+    std::memcpy(tables.vehicleKnown.data(), data + l.known, h.vehicleSlots);
+    bool valid = inRange(h.peakMultiplier, 1, 100) && inRange(h.minFare, 0, 1e6);
+    for (size_t id = 0; id < h.vehicleSlots; ++id) {
+        const Rates &r = tables.ratesById[id];
+        valid = valid && tables.vehicleKnown[id] <= 1 && inRange(r.base, 0, 1e6) && inRange(r.perKm, 0, 1e6) &&
+                inRange(r.perMin, 0, 1e6) && inRange(r.bookingFee, 0, 1e6) &&
+                (isTimeMetered(static_cast<int>(id)) || r.perMin == 0);
+    }
+
+    std::vector<Promo> promoRates(h.promoCount);
+    std::vector<PromoKey> keys(h.promoCount);
+    std::vector<PromoTable::Slot> slots(h.slotCount);
+    std::vector<uint16_t> displacement(h.bucketCount);
+    std::memcpy(promoRates.data(), data + l.promos, promoRates.size() * sizeof(Promo));
+    std::memcpy(keys.data(), data + l.keys, keys.size() * sizeof(PromoKey));
+    for (size_t s = 0; s < slots.size(); ++s) {
+        const char *at = data + l.slots + s * sizeof(PromoTable::Slot);
+        std::memcpy(&slots[s].key, at, sizeof slots[s].key);
+        std::memcpy(&slots[s].id, at + offsetof(PromoTable::Slot, id), sizeof slots[s].id);
+    }
+    std::memcpy(displacement.data(), data + l.displacement, displacement.size() * sizeof(uint16_t));
+    for (const Promo &promo : promoRates) {
+        valid = valid && inRange(promo.percentage, 0, 1) && inRange(promo.cap, 0, 1e6);
+    }
+    tables.peakMultipliers.resize(256);
+    std::memcpy(tables.peakMultipliers.data(), data + l.multipliers, 256 * sizeof(double));
+    valid = valid && tables.peakMultipliers[0] == 1.0 && tables.peakMultipliers[1] == h.peakMultiplier;
+    for (double m : tables.peakMultipliers) valid = valid && inRange(m, 1, 100);
+    valid = valid && inRange(h.utcOffsetSeconds, -14 * 3600, 14 * 3600);
+    if (!valid) throw std::runtime_error(where + "rate out of range");
+    std::vector<uint64_t> holidays(h.holidayWords);
+    std::memcpy(holidays.data(), data + l.holidays, holidays.size() * sizeof(uint64_t));
+    tables.calendar = PeakCalendar(h.utcOffsetSeconds, reinterpret_cast<const uint8_t *>(data + l.tiers),
+                                   h.firstHoliday, std::move(holidays));
+    try {
+        tables.promos = PromoTable(std::move(promoRates), std::move(keys), std::move(slots), std::move(displacement));
+    } catch (const std::invalid_argument &e) {
+        throw std::runtime_error(where + e.what());
+    }
+    return tables;
+}
+
+// Tables from a rate-card file, compiled or text.  Throws
+// std::runtime_error if it cannot be read or a compiled card is corrupt,
+// and std::invalid_argument if a text card is malformed.
+FareTables loadFareTables(const char *path) {
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) throw std::runtime_error(string("cannot open rate card ") + path + ": " + std::strerror(errno));
+    std::unique_ptr<MappedFile> file;
+    try {
+        file = std::make_unique<MappedFile>(fd);
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+    ::close(fd);
+    const char *data = file->data();
+    size_t size = file->size();
+    if (size >= sizeof kRateCardMagic && std::memcmp(data, kRateCardMagic, sizeof kRateCardMagic) == 0) {
+        return loadCompiledRateCard(data, size, path);
+    }
+    RateCard card = parseRateCard(std::string_view(data, size), path);
+    try {
+        return buildFareTables(card);
+    } catch (const std::invalid_argument &e) {
+        throw std::invalid_argument(string(path) + ": " + e.what());
+    }
+}
+
+// Compile the rate card at inPath into a snapshot at outPath
+int runCompileRatesMode(const char *inPath, const char *outPath) {
+    try {
+        writeCompiledRateCard(loadFareTables(inPath), outPath);
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
+    return 0;
+}
+
+// Holds the live FareTables and replaces them RCU-style.  Readers never
+// block or write shared state beyond their own slot: entering a read
+// section publishes the current epoch in the thread's slot, then loads the
+// table pointer.  publish() swaps the pointer, advances the epoch and waits
+// until every reader slot is idle or shows the new epoch; only readers that
+// entered before the swap can still hold the old tables, so the store then
+// drops its reference to them.  Publishing is rare and may wait; reading is
+// two stores and a load.  Holders that outlive any read section, such as a
+// FareMeter, take a reference with pin() instead, and the tables they pin
+// are freed when the last of them lets go.
+class RateCardStore {
+public:
+    explicit RateCardStore(FareTables initial)
+        : owner_(std::make_shared<const FareTables>(std::move(initial))), current_(owner_.get()) {}
+    RateCardStore(const RateCardStore &) = delete;
+    RateCardStore &operator=(const RateCardStore &) = delete;
+
+private:
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> epoch{0};   // 0 = not reading
+    };
+
+public:
+    // Per-thread read handle.  Create it on the thread that uses it.
+    class Reader {
+    public:
+        explicit Reader(RateCardStore &store) : store_(store), slot_(std::make_unique<Slot>()) {
+            std::lock_guard<std::mutex> lock(store_.mutex_);
+            store_.readers_.push_back(slot_.get());
+        }
+        ~Reader() {
+            exit();
+            std::lock_guard<std::mutex> lock(store_.mutex_);
+            auto &readers = store_.readers_;
+            readers.erase(std::find(readers.begin(), readers.end(), slot_.get()));
+        }
+        Reader(const Reader &) = delete;
+        Reader &operator=(const Reader &) = delete;
+
+        // Tables that stay valid until exit(); sections do not nest
+        const FareTables &enter() {
+            slot_->epoch.store(store_.epoch_.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+            return *store_.current_.load(std::memory_order_seq_cst);
+        }
+        void exit() { slot_->epoch.store(0, std::memory_order_release); }
+
+    private:
+        RateCardStore &store_;
+        std::unique_ptr<Slot> slot_;
+    };
+
+    // Make next the live tables.  Returns once no reader can still see the
+    // tables it replaced, which have then been freed unless pinned.
+    void publish(FareTables next) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        next.generation = epoch_.load(std::memory_order_relaxed);
+        std::shared_ptr<const FareTables> old = std::move(owner_);
+        owner_ = std::make_shared<const FareTables>(std::move(next));
+        current_.store(owner_.get(), std::memory_order_seq_cst);
+        uint64_t epoch = epoch_.fetch_add(1, std::memory_order_seq_cst) + 1;
+        for (Slot *slot : readers_) {
+            while (true) {
+                uint64_t seen = slot->epoch.load(std::memory_order_seq_cst);
+                if (seen == 0 || seen >= epoch) break;
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+        }
+        old.reset();
+    }
+
+    // A reference to the live tables that keeps them alive across publishes
+    std::shared_ptr<const FareTables> pin() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return owner_;
+    }
+
+    // The live tables, for code that runs while nothing can publish
+    const FareTables &current() const { return *current_.load(std::memory_order_acquire); }
+
+    // Number of publishes so far; changes whenever the tables do
+    uint64_t generation() const { return epoch_.load(std::memory_order_acquire) - 1; }
+
+private:
+    std::shared_ptr<const FareTables> owner_;   // the store's reference; guarded by mutex_
+    std::atomic<const FareTables *> current_;
+    std::atomic<uint64_t> epoch_{1};
+    std::mutex mutex_;                 // guards owner_ and readers_, serialises publishers
+    std::vector<Slot *> readers_;
+};
+
+// Load the rate card at path into the store, keeping the old card if the
+// new one is unreadable or invalid.  Returns true if the card was swapped.
+static bool reloadRateCard(RateCardStore &store, const char *path) {
+    if (path == nullptr) {
+        std::cerr << "no --rates file to reload; keeping the built-in rate card\n";
+        return false;
+    }
+    try {
+        store.publish(loadFareTables(path));
+    } catch (const std::exception &e) {
+        std::cerr << "rate card not reloaded: " << e.what() << '\n';
+        return false;
+    }
+    std::cerr << "reloaded rate card from " << path << " (generation " << store.generation() << ")\n";
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Quote cache.  Fare-estimate traffic repeats itself: the same vehicle, peak
+// flag and promo with distances and times a few metres or seconds apart.
+// With a cache, trips are priced at their distance and time rounded to a
+// quantum (0.1 km and 1 minute by default), so every trip in a bucket gets
+// the same fare and one pricing serves them all.
+//
+// The table is fixed-size and 4-way set associative; a set is picked by
+// hashing the key, which packs vehicle, peak tier, promo id and the two
+// bucket numbers into 64 bits.  Entries also carry the rate-card generation
+// they were priced under, so a reload makes them misses without a flush.
+// Readers take no locks: each entry is a seqlock, and a reader that sees the
+// sequence change under it treats the entry as a miss.  Writers claim an
+// entry by making its sequence odd and skip the insert if another writer
+// has it.  Each set evicts by CLOCK: a hit sets the entry's referenced bit,
+// and the set's hand clears bits until it reaches an unreferenced entry.
+// ---------------------------------------------------------------------------
+
+class QuoteCache {
+public:
+    struct Quantum {
+        double km = 0.1;
+        double min = 1.0;
+    };
+
+    // Room for at least entries fares.  Throws std::invalid_argument if the
+    // quantum is not positive or too fine for the key's bucket fields.
+    QuoteCache(size_t entries, Quantum quantum)
+        : stepsPerKm_(1 / quantum.km), stepsPerMin_(1 / quantum.min) {
+        if (!(quantum.km > 0 && kMaxDistanceKm * stepsPerKm_ < (1 << kDistanceBits) - 1) ||
+            !(quantum.min > 0 && kMaxTimeMin * stepsPerMin_ < (1 << kTimeBits) - 1)) {
+            throw std::invalid_argument("cache quantum must be at least 0.002 km and 0.04 min");
+        }
+        size_t sets = 1;
+        while (sets * kWays < entries) sets *= 2;
+        sets_ = std::make_unique<Set[]>(sets);
+        setMask_ = sets - 1;
+    }
+
+    size_t capacity() const { return (setMask_ + 1) * kWays; }
+
+    // Round distanceKm and timeMin to the quantum in place, and return the
+    // trip's key.  Distances round to at least one quantum.
+    uint64_t quantize(uint8_t vehicleId, uint8_t peakTier, uint16_t promoId, double &distanceKm, double &timeMin) const {
+        uint64_t d = std::max<long long>(1, std::llround(distanceKm * stepsPerKm_));
+        uint64_t t = static_cast<uint64_t>(std::llround(timeMin * stepsPerMin_));
+        distanceKm = static_cast<double>(d) / stepsPerKm_;
+        timeMin = static_cast<double>(t) / stepsPerMin_;
+        return uint64_t{vehicleId} << 56 | uint64_t{peakTier} << 48 | uint64_t{promoId} << 32 |
+               d << kTimeBits | t;
+    }
+
+    // Cached fare for key under rate-card generation; false on a miss
+    bool find(uint64_t key, uint64_t generation, FareBreakdown &fare) const {
+        Set &set = sets_[mix64(key) & setMask_];
+        for (Entry &e : set.ways) {
+            uint32_t seq = e.seq.load(std::memory_order_acquire);
+            if ((seq & 1) != 0 || e.key.load(std::memory_order_relaxed) != key ||
+                e.generation.load(std::memory_order_relaxed) != generation) {
+                continue;
+            }
+            uint64_t words[kFareWords];
+            for (size_t w = 0; w < kFareWords; ++w) words[w] = e.fare[w].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (e.seq.load(std::memory_order_relaxed) != seq) return false;   // rewritten under us
+            std::memcpy(&fare, words, sizeof fare);
+            if (e.referenced.load(std::memory_order_relaxed) == 0) e.referenced.store(1, std::memory_order_relaxed);
+            return true;
+        }
+        return false;
+    }
+
+    // Store a fare.  Returns true if a live entry was evicted for it.
+    bool insert(uint64_t key, uint64_t generation, const FareBreakdown &fare) {
+        Set &set = sets_[mix64(key) & setMask_];
+        Entry *victim = nullptr;
+        for (Entry &e : set.ways) {
+            if (e.key.load(std::memory_order_relaxed) == key &&
+                e.generation.load(std::memory_order_relaxed) == generation) {
+                return false;   // another thread got there first
+            }
+        }
+        for (size_t step = 0; step < 2 * kWays && victim == nullptr; ++step) {
+            Entry &e = set.ways[set.hand.fetch_add(1, std::memory_order_relaxed) % kWays];
+            if (e.referenced.load(std::memory_order_relaxed) != 0) {
+                e.referenced.store(0, std::memory_order_relaxed);
+            } else {
+                victim = &e;
+            }
+        }
+        if (victim == nullptr) victim = &set.ways[0];
+
+        uint32_t seq = victim->seq.load(std::memory_order_relaxed);
+        if ((seq & 1) != 0 ||
+            !victim->seq.compare_exchange_strong(seq, seq + 1, std::memory_order_acquire)) {
+            return false;   // being written by another thread
+        }
+        std::atomic_thread_fence(std::memory_order_release);
+        bool evicted = victim->generation.load(std::memory_order_relaxed) != kEmpty;
+        uint64_t words[kFareWords];
+        std::memcpy(words, &fare, sizeof fare);
+        victim->key.store(key, std::memory_order_relaxed);
+        victim->generation.store(generation, std::memory_order_relaxed);
+        for (size_t w = 0; w < kFareWords; ++w) victim->fare[w].store(words[w], std::memory_order_relaxed);
+        victim->referenced.store(1, std::memory_order_relaxed);
+        victim->seq.store(seq + 2, std::memory_order_release);
+        return evicted;
+    }
+
+    // Fare for one trip through the cache, computeFare() style.  On a miss
+    // the quantized trip is priced and stored.  hit says which it was.
+    GRAB_FARE_EXACT_FP
+    FareBreakdown quote(const FareTables &tables, uint8_t vehicleId, double distanceKm, double timeMin,
+                        uint8_t peakTier, uint16_t promoId, bool &hit) {
+        uint64_t key = quantize(vehicleId, peakTier, promoId, distanceKm, timeMin);
+        FareBreakdown fare;
+        hit = find(key, tables.generation, fare);
+        if (hit) return fare;
+        if (promoId >= tables.promos.size()) promoId = 0;
+        fare = priceTrip(distanceKm, timeMin, peakTier != 0, tables.ratesById.at(vehicleId), promoId,
+                         tables.promos[promoId], tables.peakMultipliers[peakTier], tables.minFare);
+        insert(key, tables.generation, fare);
+        return fare;
+    }
+
+private:
+    static constexpr size_t kWays = 4;
+    static constexpr unsigned kDistanceBits = 17;   // key: vehicle 8, peak tier 8, promo 16, distance, time
+    static constexpr unsigned kTimeBits = 15;
+    static constexpr size_t kFareWords = sizeof(FareBreakdown) / 8;
+    static constexpr uint64_t kEmpty = ~uint64_t{0};   // generation of an unused entry
+    static_assert(sizeof(FareBreakdown) % 8 == 0, "fares are copied as whole words");
+
+    struct alignas(64) Entry {
+        std::atomic<uint32_t> seq{0};          // odd while being written
+        std::atomic<uint8_t> referenced{0};    // CLOCK bit
+        std::atomic<uint64_t> key{0};
+        std::atomic<uint64_t> generation{kEmpty};
+        std::atomic<uint64_t> fare[kFareWords] = {};
+    };
+    struct Set {
+        Entry ways[kWays];
+        std::atomic<uint32_t> hand{0};
+    };
+
+    double stepsPerKm_;
+    double stepsPerMin_;
+    std::unique_ptr<Set[]> sets_;
+    size_t setMask_ = 0;
+};
+
+// ---------------------------------------------------------------------------
+// Surge pricing.  Demand and supply are counted per cell, a cell being any
+// area id the caller assigns (grid squares, geohashes, zones) below the
+// engine's cell count.  Quote requests count as demand and driver
+// availability reports as supply.  Each cell's counts live in a ring of
+// buckets, one per tick; a background thread advances the ring once a tick,
+// sums the last windowTicks buckets and recomputes every cell's multiplier.
+//
+// Recording is one relaxed fetch_add on the cell's current bucket, demand in
+// the low 32 bits and supply in the high 32.  Multipliers are published as
+// one atomic double per cell, so pricing threads read them with a plain load
+// and never wait on the tick thread.  A recorder that read the bucket index
+// just before a tick adds to the bucket that has just closed; that bucket
+// stays in the window, so the count is still seen on the next tick.
+// ---------------------------------------------------------------------------
+
+class SurgeEngine {
+public:
+    struct Config {
+        std::chrono::milliseconds tick{1000};
+        unsigned windowTicks = 60;
+        double sensitivity = 0.5;     // multiplier added per unit of demand/supply ratio above 1
+        double maxMultiplier = 3.0;
+        double step = 0.05;           // multipliers are multiples of this
+        double maxChange = 0.1;       // per tick, up or down
+    };
+
+    // Throws std::invalid_argument if cells or the config is out of range
+    SurgeEngine(uint32_t cells, const Config &config)
+        : config_(config), cells_(cells), buckets_(config.windowTicks + 2) {
+        if (cells == 0 || cells >= kNoCell || config.tick.count() <= 0 || config.windowTicks == 0 ||
+            config.windowTicks > 100000 || !(config.sensitivity >= 0) || !(config.maxMultiplier >= 1) ||
+            !(config.maxMultiplier <= 100) || !(config.step > 0) || !(config.maxChange >= config.step)) {
+            throw std::invalid_argument("surge: cells must be in [1, 4294967294] and the config in range");
+        }
+        counts_ = std::make_unique<std::atomic<uint64_t>[]>(size_t{buckets_} * cells_);
+        multipliers_ = std::make_unique<std::atomic<double>[]>(cells_);
+        for (uint32_t c = 0; c < cells_; ++c) multipliers_[c].store(1.0, std::memory_order_relaxed);
+    }
+    ~SurgeEngine() { stop(); }
+    SurgeEngine(const SurgeEngine &) = delete;
+    SurgeEngine &operator=(const SurgeEngine &) = delete;
+
+    uint32_t cells() const { return cells_; }
+    const Config &config() const { return config_; }
+
+    // Count quote requests or available drivers; cells out of range are
+    // ignored
+    void recordDemand(uint32_t cell, uint32_t requests = 1) { record(cell, requests); }
+    void recordSupply(uint32_t cell, uint32_t drivers) { record(cell, uint64_t{drivers} << 32); }
+
+    // Current multiplier of a cell, 1.0 for cells out of range
+    double multiplier(uint32_t cell) const {
+        return cell < cells_ ? multipliers_[cell].load(std::memory_order_relaxed) : 1.0;
+    }
+
+    // Advance the window by one bucket and recompute every multiplier.  The
+    // tick thread calls this; call it directly only if start() was not.
+    void tick() {
+        uint32_t current = (bucket_.load(std::memory_order_relaxed) + 1) % buckets_;
+        bucket_.store(current, std::memory_order_relaxed);
+        uint32_t oldest = (current + 1) % buckets_;
+        std::atomic<uint64_t> *expired = &counts_[size_t{oldest} * cells_];
+        for (uint32_t c = 0; c < cells_; ++c) expired[c].store(0, std::memory_order_relaxed);
+
+        demand_.assign(cells_, 0);
+        supply_.assign(cells_, 0);
+        for (uint32_t b = 0; b < buckets_; ++b) {
+            if (b == current || b == oldest) continue;
+            const std::atomic<uint64_t> *bucket = &counts_[size_t{b} * cells_];
+            for (uint32_t c = 0; c < cells_; ++c) {
+                uint64_t counts = bucket[c].load(std::memory_order_relaxed);
+                demand_[c] += counts & 0xffffffffu;
+                supply_[c] += counts >> 32;
+            }
+        }
+        for (uint32_t c = 0; c < cells_; ++c) {
+            double previous = multipliers_[c].load(std::memory_order_relaxed);
+            multipliers_[c].store(nextMultiplier(previous, static_cast<double>(demand_[c]),
+                                                 static_cast<double>(supply_[c])),
+                                  std::memory_order_relaxed);
+        }
+        ticks_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint64_t ticks() const { return ticks_.load(std::memory_order_relaxed); }
+
+    // Tick on a background thread every config().tick until stop()
+    void start() {
+        stopping_ = false;
+        thread_ = std::thread([this] {
+            auto next = std::chrono::steady_clock::now() + config_.tick;
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (!wake_.wait_until(lock, next, [this] { return stopping_; })) {
+                tick();
+                next += config_.tick;
+            }
+        });
+    }
+
+    void stop() {
+        if (!thread_.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        thread_.join();
+    }
+
+private:
+    static_assert(std::atomic<double>::is_always_lock_free, "pricing threads must not block on a multiplier");
+
+    void record(uint32_t cell, uint64_t amount) {
+        if (cell >= cells_) return;
+        uint32_t b = bucket_.load(std::memory_order_relaxed);
+        counts_[size_t{b} * cells_ + cell].fetch_add(amount, std::memory_order_relaxed);
+    }
+
+    // Target 1 + sensitivity * (demand / supply - 1), clamped to [1, max] and
+    // rounded to a step; move towards it by at most maxChange a tick so a
+    // burst does not make fares jump
+    double nextMultiplier(double previous, double demand, double supply) const {
+        double ratio = demand / std::max(supply, 1.0);
+        double target = std::clamp(1 + config_.sensitivity * (ratio - 1), 1.0, config_.maxMultiplier);
+        target = std::round(target / config_.step) * config_.step;
+        double next = std::clamp(target, previous - config_.maxChange, previous + config_.maxChange);
+        return std::max(1.0, std::round(next / config_.step) * config_.step);
+    }
+
+    Config config_;
+    uint32_t cells_;
+    uint32_t buckets_;                                    // windowTicks + the current and oldest buckets
+    std::unique_ptr<std::atomic<uint64_t>[]> counts_;     // [bucket][cell], demand | supply << 32
+    std::unique_ptr<std::atomic<double>[]> multipliers_;
+    std::vector<uint64_t> demand_, supply_;               // window sums, tick thread only
+    std::atomic<uint32_t> bucket_{0};
+    std::atomic<uint64_t> ticks_{0};
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stopping_ = false;
+};
+
+// Drive a SurgeEngine with synthetic traffic on a 32 x 32 grid for the
+// given number of seconds while pricing threads quote economy trips in
+// random cells.  Every cell has twice as many drivers as riders, except
+// around a hotspot that moves each second; once a second the surging cells
+// and quote rate are printed, and at the end the latency of a quote
+// including its multiplier read.
+int runSurgeSimMode(const FareTables &tables, double seconds, unsigned threads) {
+    constexpr uint32_t kSide = 32;
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    if (!(seconds > 0 && seconds <= 3600) || threads > 256 || tables.ratesById.size() <= 1 ||
+        !tables.vehicleKnown[1]) {
+        std::cerr << "--surge-sim needs 0 < SECONDS <= 3600, at most 256 threads and vehicle 1\n";
+        return 2;
+    }
+    SurgeEngine::Config config;
+    config.tick = std::chrono::milliseconds(100);
+    config.windowTicks = 10;
+    SurgeEngine engine(kSide * kSide, config);
+    engine.start();
+
+    std::atomic<bool> done{false};
+    std::atomic<uint64_t> quotes{0};
+    std::vector<double> fareTotals(threads);
+    std::vector<std::unique_ptr<LatencyHistogram>> latency;
+    std::vector<std::thread> pricers;
+    for (unsigned t = 0; t < threads; ++t) {
+        latency.push_back(std::make_unique<LatencyHistogram>());
+        pricers.emplace_back([&, t, histogram = latency.back().get()] {
+            const Rates &rates = tables.ratesById[1];
+            uint64_t state = t + 1;
+            uint64_t priced = 0;
+            double fareTotal = 0;
+            while (!done.load(std::memory_order_relaxed)) {
+                state = mix64(state + 0x9E3779B97F4A7C15ULL);
+                double distanceKm = 1.0 + static_cast<double>(state % 2000) / 100.0;
+                uint64_t start = profileTicks();
+                double multiplier = engine.multiplier(static_cast<uint32_t>((state >> 32) % (kSide * kSide)));
+                FareBreakdown fb = priceTrip(distanceKm, distanceKm * 2.5, multiplier != 1.0, rates, 0,
+                                             tables.promos[0], multiplier, tables.minFare);
+                histogram->record(profileTicks() - start);
+                fareTotal += fb.totalPayable;
+                if (++priced % 1024 == 0) quotes.fetch_add(1024, std::memory_order_relaxed);
+            }
+            fareTotals[t] = fareTotal;
+        });
+    }
+
+    // Per 10 ms: one rider and two drivers in every cell, plus a 5 x 5
+    // patch of extra riders weighted 4 at the centre, 2 next to it, 1 at the
+    // edge.  Over a full window the centre sees 2.5 riders per driver.
+    auto begin = std::chrono::steady_clock::now();
+    auto wake = begin;
+    uint64_t lastQuotes = 0;
+    for (unsigned step = 1; step <= static_cast<unsigned>(seconds * 100); ++step) {
+        unsigned second = (step - 1) / 100;
+        uint32_t hotRow = (8 + 5 * second) % kSide, hotCol = (8 + 3 * second) % kSide;
+        for (uint32_t cell = 0; cell < kSide * kSide; ++cell) {
+            engine.recordDemand(cell, 1);
+            engine.recordSupply(cell, 2);
+        }
+        for (int dr = -2; dr <= 2; ++dr) {
+            for (int dc = -2; dc <= 2; ++dc) {
+                uint32_t weight = 4u >> std::max(std::abs(dr), std::abs(dc));
+                uint32_t row = (hotRow + kSide + static_cast<uint32_t>(dr)) % kSide;
+                uint32_t col = (hotCol + kSide + static_cast<uint32_t>(dc)) % kSide;
+                engine.recordDemand(row * kSide + col, weight);
+            }
+        }
+        wake += std::chrono::milliseconds(10);
+        std::this_thread::sleep_until(wake);
+        if (step % 100 != 0) continue;
+
+        uint32_t surging = 0, highestCell = 0;
+        for (uint32_t cell = 0; cell < kSide * kSide; ++cell) {
+            surging += engine.multiplier(cell) > 1.0;
+            if (engine.multiplier(cell) > engine.multiplier(highestCell)) highestCell = cell;
+        }
+        uint64_t total = quotes.load(std::memory_order_relaxed);
+        std::cout << std::fixed << std::setprecision(2) << "t=" << step / 100 << "s  ticks " << engine.ticks()
+                  << "  hotspot (" << hotRow << "," << hotCol << ")  surging cells " << surging << "  highest "
+                  << engine.multiplier(highestCell) << "x at (" << highestCell / kSide << ","
+                  << highestCell % kSide << ")  quotes/s " << total - lastQuotes << '\n';
+        lastQuotes = total;
+    }
+    done.store(true);
+    for (auto &t : pricers) t.join();
+    engine.stop();
+
+    LatencyHistogram all;
+    for (const auto &h : latency) all.mergeFrom(*h);
+    double ns = nanosPerTick();
+    double fareTotal = 0;
+    for (double f : fareTotals) fareTotal += f;
+    std::cout << std::setprecision(0) << "quote incl. multiplier read: p50 " << all.percentile(0.5) * ns
+              << " ns, p99 " << all.percentile(0.99) * ns << " ns, p99.9 " << all.percentile(0.999) * ns
+              << " ns over " << all.count() << " quotes on " << threads << " thread"
+              << (threads == 1 ? "" : "s") << std::setprecision(2) << ", average fare RM "
+              << fareTotal / static_cast<double>(std::max<uint64_t>(all.count(), 1)) << '\n';
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Quote server.  Listens on 127.0.0.1 and speaks the CSV formats over TCP:
+// each request line is a trip as --csv reads it, and each response line is
+// the matching --csv output row, or "ERR <reason>".  Connections stay open
+// for any number of requests and a client may pipeline as many as it likes;
+// responses come back in request order.
+//
+// There is one event loop per thread, each with its own SO_REUSEPORT
+// listening socket on the same port, so the kernel spreads connections
+// across loops and a connection lives on one loop for its whole life.
+// Sockets are non-blocking and level-triggered.  Stopping is signalled to
+// every loop through one shared eventfd.
+//
+// Each loop coalesces requests from all its connections into micro-batches
+// priced through computeFareBatch(), so single quotes still get the SIMD
+// kernels.  A batch is priced once it holds maxRows trips or its oldest
+// request has waited window.  While a batch is open the loop sleeps in
+// epoll_pwait2() only until the window closes, with timer slack cut to
+// 1 ns, so no request is held much past it.
+// ---------------------------------------------------------------------------
+
+struct QuoteBatchPolicy {
+    std::chrono::microseconds window{20};   // 0 = price whatever one poll brought in
+    size_t maxRows = 64;
+};
+
+constexpr size_t kMaxRequestLine = 4096;
+constexpr size_t kMaxPendingOutput = 1 << 20;   // stop reading a client past this
+
+struct QuoteConnection {
+    int fd;
+    string input;         // bytes after the last complete request line
+    TextBuffer output;    // responses not yet written
+    size_t outputSent = 0;
+    size_t queued = 0;    // requests waiting in the loop's open batch
+    uint32_t events = EPOLLIN | EPOLLRDHUP;   // what epoll is watching for
+    bool closeAfterFlush = false;
+    bool dead = false;
+
+    explicit QuoteConnection(int socket) : fd(socket), output(16384) {}
+};
+
+// Open a non-blocking listening socket on 127.0.0.1:port with SO_REUSEPORT.
+// Throws std::runtime_error on failure.
+static int openQuoteListener(uint16_t port) {
+    int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) throw std::runtime_error(string("socket: ") + std::strerror(errno));
+    int one = 1;
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one) != 0 ||
+        ::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof one) != 0 ||
+        ::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof addr) != 0 || ::listen(fd, SOMAXCONN) != 0) {
+        int err = errno;
+        ::close(fd);
+        throw std::runtime_error("cannot listen on 127.0.0.1:" + std::to_string(port) + ": " + std::strerror(err));
+    }
+    return fd;
+}
+
+// Port a listening socket is bound to
+static uint16_t boundPort(int fd) {
+    sockaddr_in addr{};
+    socklen_t len = sizeof addr;
+    if (::getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &len) != 0) {
+        throw std::runtime_error(string("getsockname: ") + std::strerror(errno));
+    }
+    return ntohs(addr.sin_port);
+}
+
+// One event loop: its own epoll set, listening socket and connections
+class QuoteLoop {
+public:
+    // Takes ownership of listenFd; stopFd, the optional cache and the
+    // optional surge engine are shared and stay the caller's
+    QuoteLoop(RateCardStore &store, int listenFd, int stopFd, const QuoteBatchPolicy &policy, QuoteCache *cache,
+              SurgeEngine *surge)
+        : store_(store), cache_(cache), surge_(surge), listenFd_(listenFd), stopFd_(stopFd), policy_(policy),
+          trips_(std::max<size_t>(policy.maxRows, 1)), fares_(std::max<size_t>(policy.maxRows, 1)),
+          hits_(cache != nullptr ? trips_.capacity() : 0), hitFares_(hits_.capacity()),
+          cacheKeys_(cache != nullptr ? trips_.capacity() : 0),
+          surgeRows_(surge != nullptr ? trips_.capacity() : 0) {
+        epollFd_ = ::epoll_create1(EPOLL_CLOEXEC);
+        if (epollFd_ < 0) throw std::runtime_error(string("epoll_create1: ") + std::strerror(errno));
+        watch(listenFd_, EPOLLIN, &listenFd_);
+        watch(stopFd_, EPOLLIN, &stopFd_);
+        if (cache != nullptr) {
+            size_t slots = 1;
+            while (slots < 2 * trips_.capacity()) slots *= 2;
+            batchKeys_.resize(slots);
+        }
+    }
+    ~QuoteLoop() {
+        for (auto &c : connections_) ::close(c->fd);
+        ::close(listenFd_);
+        ::close(epollFd_);
+    }
+    QuoteLoop(const QuoteLoop &) = delete;
+    QuoteLoop &operator=(const QuoteLoop &) = delete;
+
+    // Serve until the stop eventfd becomes readable
+    void run() {
+        ::prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL);
+        RateCardStore::Reader reader(store_);
+        reader_ = &reader;
+        epoll_event events[256];
+        while (true) {
+            int n = waitForEvents(events, 256);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                throw std::runtime_error(string("epoll_wait: ") + std::strerror(errno));
+            }
+            for (int i = 0; i < n; ++i) {
+                void *tag = events[i].data.ptr;
+                if (tag == &stopFd_) return;
+                if (tag == &listenFd_) {
+                    acceptAll();
+                } else {
+                    serviceConnection(static_cast<QuoteConnection *>(tag), events[i].events);
+                }
+            }
+            if (!pending_.empty() &&
+                std::chrono::steady_clock::now() - batchOpened_ >= policy_.window) {
+                priceBatch();
+            }
+            reapClosed();
+        }
+    }
+
+    uint64_t quotes() const { return quotes_; }
+    uint64_t batches() const { return batches_; }
+    uint64_t cacheHits() const { return cacheHits_; }
+    uint64_t cacheMisses() const { return cacheMisses_; }
+    uint64_t cacheBypassed() const { return cacheBypassed_; }
+    uint64_t cacheEvictions() const { return cacheEvictions_; }
+
+private:
+    // Wait for events, but only until the open batch's window closes.
+    // Kernels before 5.11 lack epoll_pwait2(); there the loop polls.
+    int waitForEvents(epoll_event *events, int maxEvents) {
+        if (pending_.empty()) return ::epoll_wait(epollFd_, events, maxEvents, -1);
+        auto remaining = policy_.window - (std::chrono::steady_clock::now() - batchOpened_);
+        if (remaining.count() > 0 && havePwait2_) {
+            long ns = static_cast<long>(std::chrono::duration_cast<std::chrono::nanoseconds>(remaining).count());
+            timespec timeout{ns / 1000000000, ns % 1000000000};
+            int n = ::epoll_pwait2(epollFd_, events, maxEvents, &timeout, nullptr);
+            if (n >= 0 || errno != ENOSYS) return n;
+            havePwait2_ = false;
+        }
+        return ::epoll_wait(epollFd_, events, maxEvents, 0);
+    }
+
+    void watch(int fd, uint32_t events, void *tag) {
+        epoll_event ev{};
+        ev.events = events;
+        ev.data.ptr = tag;
+        if (::epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            throw std::runtime_error(string("epoll_ctl: ") + std::strerror(errno));
+        }
+    }
+
+    void acceptAll() {
+        while (true) {
+            int fd = ::accept4(listenFd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) continue;
+                return;   // EAGAIN, or out of descriptors until someone closes
+            }
+            int one = 1;
+            ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+            connections_.push_back(std::make_unique<QuoteConnection>(fd));
+            watch(fd, connections_.back()->events, connections_.back().get());
+        }
+    }
+
+    void serviceConnection(QuoteConnection *c, uint32_t events) {
+        if (events & (EPOLLERR | EPOLLHUP)) {
+            drop(c);
+            return;
+        }
+        if (events & EPOLLIN) readRequests(c);
+        if (!c->dead) flushResponses(c);
+    }
+
+    void drop(QuoteConnection *c) {
+        c->dead = true;
+        closed_.push_back(c);
+    }
+
+    // Read what is available and answer each complete line.  A short read
+    // means the socket is drained; anything racing in after it shows up as
+    // the next level-triggered event.
+    void readRequests(QuoteConnection *c) {
+        char buf[65536];
+        while (!c->dead && c->output.view().size() - c->outputSent < kMaxPendingOutput) {
+            ssize_t got = ::read(c->fd, buf, sizeof buf);
+            if (got < 0) {
+                if (errno == EINTR) continue;
+                if (errno != EAGAIN) drop(c);
+                return;
+            }
+            if (got == 0) {
+                c->closeAfterFlush = true;
+                return;
+            }
+            answerLines(c, std::string_view(buf, static_cast<size_t>(got)));
+            if (c->closeAfterFlush || static_cast<size_t>(got) < sizeof buf) return;
+        }
+    }
+
+    void answerLines(QuoteConnection *c, std::string_view data) {
+        // Lines that arrive whole in this read are answered straight from
+        // the read buffer; only a partial tail is copied
+        if (!c->input.empty()) {
+            size_t nl = data.find('\n');
+            if (nl == std::string_view::npos) {
+                c->input.append(data.data(), data.size());
+                if (c->input.size() > kMaxRequestLine) tooLong(c);
+                return;
+            }
+            c->input.append(data.data(), nl);
+            answer(c, c->input);
+            c->input.clear();
+            data.remove_prefix(nl + 1);
+        }
+        while (!data.empty()) {
+            size_t nl = data.find('\n');
+            if (nl == std::string_view::npos) {
+                if (data.size() > kMaxRequestLine) {
+                    tooLong(c);
+                } else {
+                    c->input.assign(data.data(), data.size());
+                }
+                return;
+            }
+            answer(c, data.substr(0, nl));
+            data.remove_prefix(nl + 1);
+        }
+    }
+
+    void tooLong(QuoteConnection *c) {
+        enqueue(c, "request line too long", Answer::Priced);
+        c->input.clear();
+        c->closeAfterFlush = true;
+    }
+
+    // Where a queued line's response comes from
+    enum class Answer : uint8_t { Priced, Cached, Repeat, Ok };   // trips_, hits_, an earlier trips_ row, or "OK"
+
+    // Queue one request line's answer.  A rejected line is queued too, so
+    // it is answered in order with the requests around it.  A trip with a
+    // cell counts as demand there and takes the cell's surge multiplier.
+    // With a cache, an unsurged trip is quantized and a cached fare moves it
+    // out of the batch, as does an earlier trip of this batch with the same
+    // key; both count as hits.  Surged trips count as bypassing the cache.
+    void answer(QuoteConnection *c, std::string_view line) {
+        if (trimView(line).empty()) return;
+        if (line.substr(0, 7) == "supply,") {
+            enqueue(c, recordSupply(line.substr(7)), Answer::Ok);
+            return;
+        }
+        openBatch();
+        const char *error = parseTripLine(line, *tables_, trips_);
+        bool surged = false;
+        if (error == nullptr && surge_ != nullptr) {
+            size_t row = trips_.count - 1;
+            uint32_t cell = trips_.cell[row];
+            surgeRows_[row] = 1.0;
+            if (cell != kNoCell && cell >= surge_->cells()) {
+                trips_.count = row;
+                error = "cell out of range";
+            } else if (cell != kNoCell) {
+                surge_->recordDemand(cell);
+                surgeRows_[row] = surge_->multiplier(cell);
+                surged = surgeRows_[row] != 1.0;
+            }
+        }
+        if (error == nullptr && cache_ != nullptr && surged) ++cacheBypassed_;
+        if (error == nullptr && cache_ != nullptr && !surged) {
+            size_t row = trips_.count - 1;
+            uint64_t key = cache_->quantize(trips_.vehicleId[row], trips_.isPeak[row], trips_.promoId[row],
+                                            trips_.distanceKm[row], trips_.timeMin[row]);
+            FareBreakdown fare;
+            if (cache_->find(key, tables_->generation, fare)) {
+                ++cacheHits_;
+                size_t hit = hits_.count++;
+                hits_.distanceKm[hit] = trips_.distanceKm[row];
+                hits_.timeMin[hit] = trips_.timeMin[row];
+                hits_.vehicleId[hit] = trips_.vehicleId[row];
+                hits_.isPeak[hit] = trips_.isPeak[row];
+                hitFares_.setRow(hit, fare);
+                trips_.count = row;
+                enqueue(c, nullptr, Answer::Cached);
+                if (batchFull()) priceBatch();
+                return;
+            }
+            size_t first = claimBatchKey(key, row);
+            if (first != row) {
+                ++cacheHits_;
+                ++batchRepeats_;
+                trips_.count = row;
+                enqueue(c, nullptr, Answer::Repeat, first);
+                return;
+            }
+            ++cacheMisses_;
+            cacheKeys_[row] = key;
+        }
+        enqueue(c, error, Answer::Priced);
+        if (batchFull()) priceBatch();
+    }
+
+    // "supply,CELL,DRIVERS": drivers available in a cell.  Returns null or
+    // the reason the line was rejected.
+    const char *recordSupply(std::string_view fields) {
+        if (surge_ == nullptr) return "surge pricing is off";
+        size_t comma = fields.find(',');
+        double cell, drivers;
+        if (comma == std::string_view::npos || !parseNumber(fields.substr(0, comma), cell) ||
+            !parseNumber(fields.substr(comma + 1), drivers)) {
+            return "expected supply,cell,drivers";
+        }
+        if (cell != std::floor(cell) || cell < 0 || cell >= surge_->cells()) return "cell out of range";
+        if (drivers != std::floor(drivers) || drivers < 0 || drivers > 1e6) {
+            return "drivers must be a whole number in [0, 1000000]";
+        }
+        surge_->recordSupply(static_cast<uint32_t>(cell), static_cast<uint32_t>(drivers));
+        return nullptr;
+    }
+
+    bool batchFull() const { return trips_.count + hits_.count == trips_.capacity(); }
+
+    // The trips_ row already pricing key in the open batch, or row after
+    // recording it as that row.  batchKeys_ is open-addressed at twice the
+    // batch size; entries of earlier batches are stale by their stamp, so
+    // nothing is cleared between batches.
+    size_t claimBatchKey(uint64_t key, size_t row) {
+        const uint64_t stamp = batches_ + 1;
+        const size_t mask = batchKeys_.size() - 1;
+        for (size_t i = mix64(key) & mask;; i = (i + 1) & mask) {
+            BatchKey &k = batchKeys_[i];
+            if (k.stamp != stamp) {
+                k = {key, stamp, static_cast<uint32_t>(row)};
+                return row;
+            }
+            if (k.key == key) return k.row;
+        }
+    }
+
+    void enqueue(QuoteConnection *c, const char *error, Answer answer, size_t row = 0) {
+        openBatch();
+        pending_.push_back({c, error, answer, static_cast<uint32_t>(row)});
+        ++c->queued;
+    }
+
+    // A batch is parsed and priced against one rate card, held from its
+    // first line until it has been priced
+    void openBatch() {
+        if (tables_ != nullptr) return;
+        tables_ = &reader_->enter();
+        batchOpened_ = std::chrono::steady_clock::now();
+    }
+
+    // Price the open batch and append every queued answer, in arrival
+    // order, to its connection's output
+    void priceBatch() {
+        TripColumns trips = trips_.columns();
+        if (surge_ != nullptr) trips.surge = surgeRows_.data();
+        computeFareBatch(trips, *tables_, fares_.columns());
+        if (cache_ != nullptr) {
+            for (size_t row = 0; row < trips_.count; ++row) {
+                if (surge_ != nullptr && surgeRows_[row] != 1.0) continue;
+                cacheEvictions_ += cache_->insert(cacheKeys_[row], tables_->generation, fares_.row(row));
+            }
+        }
+        quotes_ += trips_.count + hits_.count + batchRepeats_;
+        ++batches_;
+        size_t row = 0, hit = 0;
+        for (const PendingAnswer &p : pending_) {
+            if (p.conn != nullptr) {
+                if (p.error != nullptr) {
+                    p.conn->output.append("ERR ");
+                    p.conn->output.append(p.error);
+                    p.conn->output.append('\n');
+                } else if (p.answer == Answer::Ok) {
+                    p.conn->output.append("OK\n");
+                } else if (p.answer == Answer::Cached) {
+                    appendCsvRow(p.conn->output, hits_, hitFares_, hit, tables_->promos);
+                } else if (p.answer == Answer::Repeat) {
+                    appendCsvRow(p.conn->output, trips_, fares_, p.row, tables_->promos);
+                } else {
+                    appendCsvRow(p.conn->output, trips_, fares_, row, tables_->promos);
+                }
+                --p.conn->queued;
+            }
+            if (p.error == nullptr && p.answer == Answer::Priced) ++row;
+            if (p.error == nullptr && p.answer == Answer::Cached) ++hit;
+        }
+        trips_.count = 0;
+        hits_.count = 0;
+        batchRepeats_ = 0;
+        tables_ = nullptr;
+        reader_->exit();
+        for (const PendingAnswer &p : pending_) {
+            if (p.conn != nullptr && !p.conn->dead && p.conn->queued == 0) flushResponses(p.conn);
+        }
+        pending_.clear();
+    }
+
+    // Write as much pending output as the socket takes; watch for
+    // writability only while some is left over
+    void flushResponses(QuoteConnection *c) {
+        std::string_view pending = c->output.view().substr(c->outputSent);
+        while (!pending.empty()) {
+            ssize_t sent = ::send(c->fd, pending.data(), pending.size(), MSG_NOSIGNAL);
+            if (sent < 0) {
+                if (errno == EINTR) continue;
+                if (errno != EAGAIN) {
+                    drop(c);
+                    return;
+                }
+                break;
+            }
+            c->outputSent += static_cast<size_t>(sent);
+            pending.remove_prefix(static_cast<size_t>(sent));
+        }
+        if (pending.empty()) {
+            c->output.clear();
+            c->outputSent = 0;
+            if (c->closeAfterFlush && c->queued == 0) {
+                drop(c);
+                return;
+            }
+        }
+        // Stop reading while the client is not keeping up with its replies
+        bool backlogged = pending.size() >= kMaxPendingOutput;
+        uint32_t events = (backlogged || c->closeAfterFlush ? 0u : EPOLLIN | EPOLLRDHUP) |
+                          (pending.empty() ? 0u : EPOLLOUT);
+        if (events != c->events) {
+            epoll_event ev{};
+            ev.events = events;
+            ev.data.ptr = c;
+            ::epoll_ctl(epollFd_, EPOLL_CTL_MOD, c->fd, &ev);
+            c->events = events;
+        }
+    }
+
+    void reapClosed() {
+        if (closed_.empty()) return;
+        std::sort(closed_.begin(), closed_.end());
+        closed_.erase(std::unique(closed_.begin(), closed_.end()), closed_.end());
+        for (PendingAnswer &p : pending_) {
+            if (p.conn != nullptr && p.conn->dead) p.conn = nullptr;   // still priced, never sent
+        }
+        for (QuoteConnection *c : closed_) {
+            ::close(c->fd);
+            auto it = std::find_if(connections_.begin(), connections_.end(),
+                                   [c](const auto &p) { return p.get() == c; });
+            std::swap(*it, connections_.back());
+            connections_.pop_back();
+        }
+        closed_.clear();
+    }
+
+    struct PendingAnswer {
+        QuoteConnection *conn;   // null once the connection has closed
+        const char *error;       // null unless the line was rejected
+        Answer answer;
+        uint32_t row;            // trips_ row a Repeat answer copies
+    };
+
+    struct BatchKey {
+        uint64_t key;
+        uint64_t stamp;          // batches_ + 1 of the batch that wrote it
+        uint32_t row;
+    };
+
+    RateCardStore &store_;
+    QuoteCache *cache_;                         // null when caching is off
+    SurgeEngine *surge_;                        // null when surge pricing is off
+    RateCardStore::Reader *reader_ = nullptr;   // run()'s, while it runs
+    const FareTables *tables_ = nullptr;        // pinned while a batch is open
+    int listenFd_;
+    int stopFd_;
+    int epollFd_;
+    QuoteBatchPolicy policy_;
+    TripBatch trips_;
+    FareBatch fares_;
+    TripBatch hits_;                   // trips answered from the cache, in order
+    FareBatch hitFares_;
+    std::vector<uint64_t> cacheKeys_;  // cache key of each row of trips_
+    std::vector<BatchKey> batchKeys_;  // keys being priced in the open batch, see claimBatchKey()
+    size_t batchRepeats_ = 0;          // Repeat answers in the open batch
+    std::vector<double> surgeRows_;    // surge multiplier of each row of trips_
+    std::vector<PendingAnswer> pending_;
+    std::chrono::steady_clock::time_point batchOpened_;
+    bool havePwait2_ = true;
+    uint64_t quotes_ = 0;
+    uint64_t batches_ = 0;
+    uint64_t cacheHits_ = 0;
+    uint64_t cacheMisses_ = 0;
+    uint64_t cacheBypassed_ = 0;
+    uint64_t cacheEvictions_ = 0;
+    std::vector<std::unique_ptr<QuoteConnection>> connections_;
+    std::vector<QuoteConnection *> closed_;
+};
+
+// Serve quotes on 127.0.0.1:port (0 = any free port) with the given number
+// of event loops (0 = one per core) until SIGINT or SIGTERM, reloading the
+// rate card from ratesPath on SIGHUP.  All loops share the cache and the
+// surge engine, if any; the engine ticks while the server runs.
+int runServeMode(RateCardStore &store, const char *ratesPath, uint16_t port, unsigned loops,
+                 const QuoteBatchPolicy &policy, QuoteCache *cache, SurgeEngine *surge) {
+    if (loops == 0) loops = std::max(1u, std::thread::hardware_concurrency());
+
+    // Block the stop and reload signals in every thread; this one waits for them
+    sigset_t stopSignals;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    sigaddset(&stopSignals, SIGTERM);
+    sigaddset(&stopSignals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &stopSignals, nullptr);
+
+    int stopFd = -1;
+    std::vector<std::unique_ptr<QuoteLoop>> eventLoops;
+    try {
+        stopFd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (stopFd < 0) throw std::runtime_error(string("eventfd: ") + std::strerror(errno));
+        for (unsigned i = 0; i < loops; ++i) {
+            int listenFd = openQuoteListener(port);
+            if (port == 0) port = boundPort(listenFd);
+            try {
+                eventLoops.push_back(std::make_unique<QuoteLoop>(store, listenFd, stopFd, policy, cache, surge));
+            } catch (...) {
+                ::close(listenFd);
+                throw;
+            }
+        }
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << '\n';
+        if (stopFd >= 0) ::close(stopFd);
+        return 1;
+    }
+    std::cerr << "serving quotes on 127.0.0.1:" << port << " with " << loops << " event loop"
+              << (loops == 1 ? "" : "s") << ", batches of up to " << policy.maxRows << " within "
+              << policy.window.count() << " us\n";
+
+    if (surge != nullptr) surge->start();
+    std::atomic<bool> failed{false};
+    std::vector<std::thread> threads;
+    for (auto &loop : eventLoops) {
+        threads.emplace_back([&failed, &loop] {
+            try {
+                loop->run();
+            } catch (const std::exception &e) {
+                std::cerr << e.what() << '\n';
+                failed.store(true);
+                ::kill(::getpid(), SIGTERM);   // wake the sigwait() below
+            }
+        });
+    }
+    int signal = 0;
+    while (sigwait(&stopSignals, &signal) == 0 && signal == SIGHUP) reloadRateCard(store, ratesPath);
+    uint64_t one = 1;
+    (void)!::write(stopFd, &one, sizeof one);
+    for (auto &t : threads) t.join();
+    if (surge != nullptr) surge->stop();
+    uint64_t quotes = 0, batches = 0, hits = 0, misses = 0, bypassed = 0, evictions = 0;
+    for (auto &loop : eventLoops) {
+        quotes += loop->quotes();
+        batches += loop->batches();
+        hits += loop->cacheHits();
+        misses += loop->cacheMisses();
+        bypassed += loop->cacheBypassed();
+        evictions += loop->cacheEvictions();
+    }
+    std::cerr << std::fixed << std::setprecision(1);
+    std::cerr << "priced " << quotes << " quotes in " << batches << " batches";
+    if (batches > 0) std::cerr << " (" << double(quotes) / batches << " per batch)";
+    std::cerr << '\n';
+    if (cache != nullptr) {
+        std::cerr << "quote cache: " << hits << " hits, " << misses << " misses";
+        if (hits + misses > 0) std::cerr << " (" << 100.0 * hits / (hits + misses) << "% hit rate)";
+        if (bypassed > 0) std::cerr << ", " << bypassed << " surged quotes bypassed";
+        std::cerr << ", " << evictions << " evictions from " << cache->capacity() << " entries\n";
+    }
+    if (surge != nullptr) {
+        uint32_t surging = 0;
+        double highest = 1.0;
+        for (uint32_t cell = 0; cell < surge->cells(); ++cell) {
+            surging += surge->multiplier(cell) > 1.0;
+            highest = std::max(highest, surge->multiplier(cell));
+        }
+        std::cerr << std::setprecision(2) << "surge: " << surge->ticks() << " ticks, " << surging << " of "
+                  << surge->cells() << " cells surging, highest " << highest << "x\n";
+    }
+    eventLoops.clear();
+    ::close(stopFd);
+    return failed.load() ? 1 : 0;
+}
+
+// ---------------------------------------------------------------------------
+// Shared-memory quote transport, for callers on the same host.  The server
+// creates a POSIX shared memory segment holding a header and a fixed number
+// of client slots.  Each slot has two single-producer single-consumer rings
+// of POD records: requests written by the caller and FareBreakdown responses
+// written by the server.  Nothing is serialised and no syscall is made per
+// quote; both sides poll.  Promo codes travel as folded keys both ways, so
+// callers need not share the server's promo ids, which change whenever the
+// server reloads its rate card; for the same reason trips carry their start
+// time, not a tier of the caller's calendar.
+//
+// A slot's state word holds the owner's pid and a phase.  A caller claims a
+// Free slot (Free -> Claimed), resets its rings and publishes it (Active).
+// On close it asks for release (Releasing) and the server, which only ever
+// touches Active slots, hands it back (Free).  About once a second, under
+// load or not, the server also frees Active and Claimed slots whose owner
+// process has died.
+//
+// Layout (all offsets from the start of the segment):
+//   ShmHeader                      magic, geometry, server pid
+//   ShmSlot[slotCount]             each 64-byte aligned
+// ---------------------------------------------------------------------------
+
+constexpr char kShmMagic[8] = {'G', 'R', 'A', 'B', 'S', 'H', 'M', '1'};
+constexpr uint32_t kShmVersion = 3;
+constexpr size_t kShmRingSize = 1024;   // entries per ring, a power of two
+constexpr uint32_t kShmDefaultSlots = 64;
+
+enum ShmPhase : uint64_t { kShmFree = 0, kShmClaimed = 1, kShmActive = 2, kShmReleasing = 3 };
+
+// One quote request.  The promo code travels pre-folded (see foldPromoKey);
+// an all-zero key means no promo.  A trip with a start time is sent with
+// it and the server finds the tier in its own calendar; tiers above 1 are
+// numbered per rate card, so without a start time only 0 and 1 are taken.
+struct ShmQuoteRequest {
+    double distanceKm;
+    double timeMin;
+    PromoKey promoKey;
+    uint64_t tag;          // echoed back in the response
+    int64_t startTime;     // unix seconds, or kNoStartTime to use peakTier
+    uint8_t vehicleId;
+    uint8_t peakTier;      // 0 off-peak or 1 peak; ignored with a start time
+};
+
+enum ShmQuoteStatus : uint32_t {
+    kShmQuoteOk = 0,
+    kShmUnknownVehicle = 1,
+    kShmBadDistance = 2,
+    kShmBadTime = 3,
+    kShmBadPeak = 4,
+};
+
+// Why the server turned a request down, worded as the CSV parser words it
+static const char *shmQuoteStatusText(uint32_t status) {
+    switch (status) {
+        case kShmQuoteOk: return "ok";
+        case kShmUnknownVehicle: return "unknown vehicle";
+        case kShmBadDistance: return "distance must be in (0, 200] km";
+        case kShmBadTime: return "time must be in [0, 1000] min";
+        case kShmBadPeak: return "peak tiers above 1 need a start time";
+        default: return "unknown status";
+    }
+}
+
+struct ShmQuoteResponse {
+    uint64_t tag;
+    uint32_t status;       // ShmQuoteStatus; the rest is only set for kShmQuoteOk
+    uint8_t peakTier;      // tier the trip was priced at, in the server's card
+    PromoKey promoKey;     // promo applied, folded; all zero for none
+    FareBreakdown fare;    // promoId is the server's own; use promoKey
+};
+
+static_assert(std::is_trivially_copyable<ShmQuoteRequest>::value, "requests must be POD");
+static_assert(std::is_trivially_copyable<ShmQuoteResponse>::value, "responses must be POD");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared rings need lock-free 64-bit atomics");
+
+// Single-producer single-consumer ring living in shared memory.  Indices
+// only grow; each sits on its own cache line, and each side keeps a cached
+// copy of the other's index so a push or pop usually touches one line.
+template <typename T>
+struct ShmRing {
+    alignas(64) std::atomic<uint64_t> head;    // next entry to pop, owned by the consumer
+    alignas(64) std::atomic<uint64_t> tail;    // next entry to push, owned by the producer
+    alignas(64) T entries[kShmRingSize];
+
+    void reset() {
+        head.store(0, std::memory_order_relaxed);
+        tail.store(0, std::memory_order_relaxed);
+    }
+    bool push(const T &item, uint64_t &cachedHead) {
+        uint64_t t = tail.load(std::memory_order_relaxed);
+        if (t - cachedHead == kShmRingSize) {
+            cachedHead = head.load(std::memory_order_acquire);
+            if (t - cachedHead == kShmRingSize) return false;
+        }
+        entries[t & (kShmRingSize - 1)] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+    bool pop(T &item, uint64_t &cachedTail) {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        if (h == cachedTail) {
+            cachedTail = tail.load(std::memory_order_acquire);
+            if (h == cachedTail) return false;
+        }
+        item = entries[h & (kShmRingSize - 1)];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+struct alignas(64) ShmSlot {
+    std::atomic<uint64_t> state;   // owner pid << 8 | ShmPhase
+    std::atomic<uint32_t> responseSignal;   // futex word for a caller waiting on responses
+    std::atomic<uint32_t> callerSleeping;
+    ShmRing<ShmQuoteRequest> requests;
+    ShmRing<ShmQuoteResponse> responses;
+};
+
+struct ShmHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t slotCount;
+    uint32_t ringSize;
+    uint64_t slotsOffset;
+    uint64_t segmentSize;
+    std::atomic<uint64_t> serverPid;   // 0 once the server has shut down
+    std::atomic<uint32_t> requestSignal;    // futex word for servers with nothing to do
+    std::atomic<uint32_t> serversSleeping;
+};
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex words must be plain 32-bit");
+
+// Sleep while word still holds expected, for at most timeoutMs.  The
+// segment is shared between processes, so these are not private futexes.
+static void futexWait(std::atomic<uint32_t> &word, uint32_t expected, long timeoutMs) {
+    timespec timeout{timeoutMs / 1000, (timeoutMs % 1000) * 1000000};
+    ::syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAIT, expected, &timeout, nullptr, 0);
+}
+
+// Bump word and wake everyone sleeping on it
+static void futexWakeAll(std::atomic<uint32_t> &word) {
+    word.fetch_add(1, std::memory_order_release);
+    ::syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);
+}
+
+static bool processAlive(uint64_t pid) {
+    return pid != 0 && (::kill(static_cast<pid_t>(pid), 0) == 0 || errno != ESRCH);
+}
+
+// Shared-memory name as shm_open() wants it, with one leading slash
+static string shmName(const char *name) {
+    return name[0] == '/' ? string(name) : "/" + string(name);
+}
+
+// A mapped quote segment.  The server creates it; callers attach to it.
+class ShmSegment {
+public:
+    // Throws std::runtime_error if the segment cannot be created or mapped,
+    // or if another live server already owns the name
+    static ShmSegment create(const char *name, uint32_t slotCount) {
+        size_t slotsOffset = alignUp(sizeof(ShmHeader), 64);
+        size_t size = slotsOffset + slotCount * sizeof(ShmSlot);
+        string path = shmName(name);
+        int fd = ::shm_open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0 && errno == EEXIST) {
+            // Left behind by a server that died, unless one is still running
+            bool running = false;
+            try {
+                attach(name);
+                running = true;
+            } catch (const std::runtime_error &) {
+            }
+            if (running) throw std::runtime_error("a quote server is already serving " + path);
+            ::shm_unlink(path.c_str());
+            fd = ::shm_open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        }
+        if (fd < 0) throw std::runtime_error("shm_open " + path + ": " + std::strerror(errno));
+        if (::ftruncate(fd, static_cast<off_t>(size)) != 0) {
+            int err = errno;
+            ::close(fd);
+            ::shm_unlink(path.c_str());
+            throw std::runtime_error("cannot size " + path + ": " + std::strerror(err));
+        }
+        ShmSegment segment(fd, size, path);
+        ShmHeader *h = segment.header();
+        std::memcpy(h->magic, kShmMagic, sizeof h->magic);
+        h->version = kShmVersion;
+        h->slotCount = slotCount;
+        h->ringSize = static_cast<uint32_t>(kShmRingSize);
+        h->slotsOffset = slotsOffset;
+        h->segmentSize = size;
+        for (uint32_t i = 0; i < slotCount; ++i) {
+            ShmSlot &slot = segment.slot(i);
+            slot.state.store(kShmFree, std::memory_order_relaxed);
+            slot.responseSignal.store(0, std::memory_order_relaxed);
+            slot.callerSleeping.store(0, std::memory_order_relaxed);
+        }
+        h->requestSignal.store(0, std::memory_order_relaxed);
+        h->serversSleeping.store(0, std::memory_order_relaxed);
+        h->serverPid.store(static_cast<uint64_t>(::getpid()), std::memory_order_release);
+        segment.owner_ = true;
+        return segment;
+    }
+
+    // Throws std::runtime_error if there is no such segment, it has another
+    // layout, or its server is gone
+    static ShmSegment attach(const char *name) {
+        string path = shmName(name);
+        int fd = ::shm_open(path.c_str(), O_RDWR, 0);
+        if (fd < 0) throw std::runtime_error("no quote server at " + path + ": " + std::strerror(errno));
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(ShmHeader)) {
+            ::close(fd);
+            throw std::runtime_error(path + " is not a quote segment");
+        }
+        ShmSegment segment(fd, static_cast<size_t>(st.st_size), path);
+        const ShmHeader *h = segment.header();
+        if (std::memcmp(h->magic, kShmMagic, sizeof h->magic) != 0 || h->version != kShmVersion ||
+            h->ringSize != kShmRingSize || h->segmentSize != segment.size_ ||
+            h->slotsOffset + h->slotCount * sizeof(ShmSlot) > segment.size_) {
+            throw std::runtime_error(path + " is not a compatible quote segment");
+        }
+        if (!processAlive(h->serverPid.load(std::memory_order_acquire))) {
+            throw std::runtime_error("quote server for " + path + " is not running");
+        }
+        return segment;
+    }
+
+    ShmSegment(ShmSegment &&other) noexcept
+        : base_(other.base_), size_(other.size_), path_(std::move(other.path_)), owner_(other.owner_) {
+        other.base_ = nullptr;
+        other.owner_ = false;
+    }
+    ~ShmSegment() {
+        if (base_ == nullptr) return;
+        if (owner_) {
+            header()->serverPid.store(0, std::memory_order_release);
+            ::shm_unlink(path_.c_str());
+        }
+        ::munmap(base_, size_);
+    }
+    ShmSegment(const ShmSegment &) = delete;
+    ShmSegment &operator=(const ShmSegment &) = delete;
+
+    ShmHeader *header() const { return reinterpret_cast<ShmHeader *>(base_); }
+    uint32_t slotCount() const { return header()->slotCount; }
+    ShmSlot &slot(uint32_t i) const {
+        return reinterpret_cast<ShmSlot *>(base_ + header()->slotsOffset)[i];
+    }
+
+private:
+    ShmSegment(int fd, size_t size, string path) : size_(size), path_(std::move(path)) {
+        void *p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        int err = errno;
+        ::close(fd);
+        if (p == MAP_FAILED) throw std::runtime_error(string("mmap failed: ") + std::strerror(err));
+        base_ = static_cast<char *>(p);
+    }
+
+    char *base_ = nullptr;
+    size_t size_ = 0;
+    string path_;
+    bool owner_ = false;
+};
+
+// Price every waiting request of one Active slot, as far as the response
+// ring has room.  Returns how many were answered.
+static size_t serviceShmSlot(ShmSlot &slot, const FareTables &tables, TripBatch &trips, FareBatch &fares,
+                             uint64_t &cachedTail, uint64_t &cachedHead) {
+    constexpr size_t kMaxPerPass = 256;
+    ShmQuoteRequest requests[kMaxPerPass];
+    uint32_t status[kMaxPerPass];
+    ShmRing<ShmQuoteResponse> &out = slot.responses;
+    size_t room = kShmRingSize - (out.tail.load(std::memory_order_relaxed) - out.head.load(std::memory_order_acquire));
+    size_t n = 0;
+    trips.count = 0;
+    while (n < std::min(room, kMaxPerPass) && slot.requests.pop(requests[n], cachedTail)) {
+        const ShmQuoteRequest &r = requests[n];
+        if (r.vehicleId >= tables.ratesById.size() || !tables.vehicleKnown[r.vehicleId]) {
+            status[n] = kShmUnknownVehicle;
+        } else if (!(r.distanceKm > 0 && r.distanceKm <= kMaxDistanceKm)) {
+            status[n] = kShmBadDistance;
+        } else if (!(r.timeMin >= 0 && r.timeMin <= kMaxTimeMin)) {
+            status[n] = kShmBadTime;
+        } else if (r.startTime == kNoStartTime && r.peakTier > 1) {
+            status[n] = kShmBadPeak;
+        } else {
+            status[n] = kShmQuoteOk;
+            size_t row = trips.count++;
+            trips.distanceKm[row] = r.distanceKm;
+            trips.timeMin[row] = r.timeMin;
+            trips.vehicleId[row] = r.vehicleId;
+            trips.isPeak[row] = r.startTime == kNoStartTime ? r.peakTier : tables.calendar.tierAt(r.startTime);
+            trips.promoId[row] = tables.promos.find(r.promoKey);
+        }
+        ++n;
+    }
+    if (n == 0) return 0;
+    computeFareBatch(trips.columns(), tables, fares.columns());
+
+    size_t row = 0;
+    for (size_t i = 0; i < n; ++i) {
+        ShmQuoteResponse response{};
+        response.tag = requests[i].tag;
+        response.status = status[i];
+        if (status[i] == kShmQuoteOk) {
+            response.peakTier = trips.isPeak[row];
+            response.fare = fares.row(row);
+            if (fares.promoId[row] != 0) response.promoKey = requests[i].promoKey;
+            ++row;
+        }
+        out.push(response, cachedHead);   // room was checked above
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);   // pairs with ShmQuoteClient::receive()
+    if (slot.callerSleeping.load(std::memory_order_relaxed) != 0) futexWakeAll(slot.responseSignal);
+    return n;
+}
+
+// Serve quotes through the shared memory segment name until SIGINT or
+// SIGTERM, reloading the rate card from ratesPath on SIGHUP.  Slot i is
+// served by thread i % threads, so every ring keeps a single consumer and a
+// single producer.
+int runShmServeMode(RateCardStore &store, const char *ratesPath, const char *name, uint32_t slotCount,
+                    unsigned threads) {
+    if (slotCount == 0) slotCount = kShmDefaultSlots;
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min<unsigned>(threads, slotCount);
+
+    sigset_t stopSignals;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    sigaddset(&stopSignals, SIGTERM);
+    sigaddset(&stopSignals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &stopSignals, nullptr);
+
+    try {
+        ShmSegment segment = ShmSegment::create(name, slotCount);
+        std::cerr << "serving quotes on shared memory " << shmName(name) << " with " << slotCount
+                  << " slots and " << threads << " thread" << (threads == 1 ? "" : "s") << '\n';
+
+        std::atomic<bool> stop{false};
+        auto serve = [&](unsigned self) {
+            RateCardStore::Reader reader(store);
+            TripBatch trips(256);
+            FareBatch fares(256);
+            std::vector<uint32_t> mine;
+            for (uint32_t i = self; i < slotCount; i += threads) mine.push_back(i);
+            std::vector<uint64_t> cachedTail(mine.size()), cachedHead(mine.size());
+            std::vector<uint64_t> lastState(mine.size(), kShmFree);
+            unsigned idle = 0;
+            uint64_t passes = 0;
+            auto lastLivenessCheck = std::chrono::steady_clock::now();
+            // Free the slots of callers that died, whether mid-claim or
+            // after; a live claimer is only between two stores
+            auto reapDeadCallers = [&] {
+                for (uint32_t i : mine) {
+                    ShmSlot &slot = segment.slot(i);
+                    uint64_t state = slot.state.load(std::memory_order_acquire);
+                    uint64_t phase = state & 0xFF;
+                    if ((phase == kShmActive || phase == kShmClaimed) && !processAlive(state >> 8)) {
+                        slot.state.compare_exchange_strong(state, kShmFree, std::memory_order_acq_rel);
+                    }
+                }
+            };
+            while (!stop.load(std::memory_order_relaxed)) {
+                // About once a second, busy or idle; the clock is read only
+                // every 256 passes
+                if ((++passes & 255) == 0) {
+                    auto now = std::chrono::steady_clock::now();
+                    if (now - lastLivenessCheck >= std::chrono::seconds(1)) {
+                        lastLivenessCheck = now;
+                        reapDeadCallers();
+                    }
+                }
+                const FareTables &tables = reader.enter();
+                size_t answered = 0;
+                for (size_t k = 0; k < mine.size(); ++k) {
+                    ShmSlot &slot = segment.slot(mine[k]);
+                    uint64_t state = slot.state.load(std::memory_order_acquire);
+                    if (state != lastState[k]) {   // new owner: its rings were just reset
+                        cachedTail[k] = 0;
+                        cachedHead[k] = 0;
+                        lastState[k] = state;
+                    }
+                    if ((state & 0xFF) == kShmReleasing) {
+                        slot.state.store(kShmFree, std::memory_order_release);
+                        lastState[k] = kShmFree;
+                    } else if ((state & 0xFF) == kShmActive) {
+                        answered += serviceShmSlot(slot, tables, trips, fares, cachedTail[k], cachedHead[k]);
+                    }
+                }
+                if (answered > 0) {
+                    idle = 0;
+                    continue;
+                }
+                // Spin briefly for the next request, then sleep until a
+                // caller signals.  A sleeping thread holds no tables, so it
+                // never holds up a rate-card swap.
+                if (++idle < 4096) {
+#ifdef GRAB_FARE_X86_SIMD
+                    _mm_pause();
+#endif
+                    continue;
+                }
+                reader.exit();
+                ShmHeader *header = segment.header();
+                uint32_t signal = header->requestSignal.load(std::memory_order_acquire);
+                header->serversSleeping.fetch_add(1, std::memory_order_seq_cst);
+                std::atomic_thread_fence(std::memory_order_seq_cst);   // pairs with ShmQuoteClient::notify()
+                bool pending = false;
+                for (uint32_t i : mine) {
+                    ShmSlot &slot = segment.slot(i);
+                    pending |= slot.requests.tail.load(std::memory_order_relaxed) !=
+                               slot.requests.head.load(std::memory_order_relaxed);
+                }
+                if (!pending && !stop.load(std::memory_order_relaxed)) {
+                    futexWait(header->requestSignal, signal, 100);
+                }
+                header->serversSleeping.fetch_sub(1, std::memory_order_relaxed);
+                idle = 0;
+            }
+        };
+
+        std::vector<std::thread> pool;
+        for (unsigned t = 1; t < threads; ++t) pool.emplace_back(serve, t);
+        std::thread first(serve, 0u);
+        int signal = 0;
+        while (sigwait(&stopSignals, &signal) == 0 && signal == SIGHUP) reloadRateCard(store, ratesPath);
+        stop.store(true);
+        futexWakeAll(segment.header()->requestSignal);
+        first.join();
+        for (auto &t : pool) t.join();
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
+    return 0;
+}
+
+// Caller side of the shared-memory transport: one slot, owned for the
+// lifetime of the object.  Not thread-safe; use one client per thread.
+class ShmQuoteClient {
+public:
+    // Throws std::runtime_error if there is no server or no free slot
+    explicit ShmQuoteClient(const char *name) : segment_(ShmSegment::attach(name)) {
+        uint64_t pid = static_cast<uint64_t>(::getpid());
+        for (uint32_t i = 0; i < segment_.slotCount(); ++i) {
+            ShmSlot &s = segment_.slot(i);
+            uint64_t expected = kShmFree;
+            if (!s.state.compare_exchange_strong(expected, pid << 8 | kShmClaimed, std::memory_order_acq_rel)) {
+                continue;
+            }
+            s.requests.reset();
+            s.responses.reset();
+            s.state.store(pid << 8 | kShmActive, std::memory_order_release);
+            slot_ = &s;
+            break;
+        }
+        if (slot_ == nullptr) throw std::runtime_error("no free quote slot");
+    }
+    ~ShmQuoteClient() {
+        uint64_t pid = static_cast<uint64_t>(::getpid());
+        slot_->state.store(pid << 8 | kShmReleasing, std::memory_order_release);
+    }
+    ShmQuoteClient(const ShmQuoteClient &) = delete;
+    ShmQuoteClient &operator=(const ShmQuoteClient &) = delete;
+
+    // Queue one request; false if the request ring is full.  The server
+    // sees it at once if it is polling; call notify() after a burst of
+    // submits in case it has gone to sleep.
+    bool trySubmit(const ShmQuoteRequest &request) { return slot_->requests.push(request, cachedHead_); }
+
+    // Wake the server if it is sleeping for lack of requests
+    void notify() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);   // pairs with the server's idle check
+        ShmHeader *header = segment_.header();
+        if (header->serversSleeping.load(std::memory_order_relaxed) != 0) futexWakeAll(header->requestSignal);
+    }
+
+    // Take the next response, in submission order; false if none is ready
+    bool tryReceive(ShmQuoteResponse &response) { return slot_->responses.pop(response, cachedTail_); }
+
+    // Wait for the next response: notify the server, spin briefly, then
+    // sleep until the server signals.  Throws std::runtime_error if the
+    // server goes away.
+    ShmQuoteResponse receive() {
+        notify();
+        ShmQuoteResponse response;
+        for (unsigned spin = 0; spin < 1024; ++spin) {
+            if (tryReceive(response)) return response;
+#ifdef GRAB_FARE_X86_SIMD
+            _mm_pause();
+#endif
+        }
+        while (true) {
+            uint32_t signal = slot_->responseSignal.load(std::memory_order_acquire);
+            slot_->callerSleeping.store(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);   // pairs with serviceShmSlot()
+            bool ready = tryReceive(response);
+            if (!ready) futexWait(slot_->responseSignal, signal, 100);
+            slot_->callerSleeping.store(0, std::memory_order_relaxed);
+            if (ready || tryReceive(response)) return response;
+            checkServer();
+        }
+    }
+
+    // Throws std::runtime_error once the server has gone away
+    void checkServer() const {
+        if (!processAlive(segment_.header()->serverPid.load(std::memory_order_acquire))) {
+            throw std::runtime_error("quote server has stopped");
+        }
+    }
+
+private:
+    ShmSegment segment_;
+    ShmSlot *slot_ = nullptr;
+    uint64_t cachedHead_ = 0;
+    uint64_t cachedTail_ = 0;
+};
+
+// Price a CSV file (or stdin) through a shared-memory quote server and
+// write the same output as --csv
+int runShmQuoteMode(const FareTables &tables, const char *name, const char *path) {
+    try {
+        ShmQuoteClient client(name);
+
+        BufferedWriter out(STDOUT_FILENO);
+        out.append(kCsvOutputHeader);
+        FareBatch fares(kBatchRows);
+        std::vector<uint32_t> status(kBatchRows);
+        size_t serverRejected = 0;
+        CsvTripReader reader(tables, [&](TripBatch &batch) {
+            size_t sent = 0, received = 0;
+            while (received < batch.count) {
+                while (sent < batch.count) {
+                    ShmQuoteRequest r{};
+                    r.distanceKm = batch.distanceKm[sent];
+                    r.timeMin = batch.timeMin[sent];
+                    foldPromoKey(tables.promos.code(batch.promoId[sent]), r.promoKey);
+                    r.tag = sent;
+                    r.startTime = batch.startTime[sent];
+                    r.vehicleId = batch.vehicleId[sent];
+                    r.peakTier = batch.isPeak[sent];
+                    if (!client.trySubmit(r)) break;
+                    ++sent;
+                }
+                // Take whatever has come back, waiting for at least one
+                client.notify();
+                ShmQuoteResponse response;
+                bool any = client.tryReceive(response);
+                if (!any) {
+                    response = client.receive();
+                    any = true;
+                }
+                for (; any; any = client.tryReceive(response)) {
+                    size_t i = static_cast<size_t>(response.tag);
+                    status[i] = response.status;
+                    if (response.status == kShmQuoteOk) {
+                        batch.isPeak[i] = response.peakTier;   // the server's calendar decides
+                        fares.setRow(i, response.fare);
+                        fares.promoId[i] = tables.promos.find(response.promoKey);
+                    }
+                    ++received;
+                }
+            }
+            // Rows the server turned down (it may run a different rate
+            // card) are reported like --csv rejects, not printed
+            for (size_t i = 0; i < batch.count; ++i) {
+                if (status[i] == kShmQuoteOk) {
+                    appendCsvRow(out, batch, fares, i, tables.promos);
+                    continue;
+                }
+                ++serverRejected;
+                std::cerr << "line " << batch.lineNo[i] << ": server rejected: " << shmQuoteStatusText(status[i])
+                          << '\n';
+            }
+        });
+        bool ok = readCsvInput(path, reader);
+        out.flush();
+        return (!ok || serverRejected > 0 || reader.rejected() > 0) ? 1 : 0;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Synthetic trip corpus.  Rows are generated in kParallelChunkRows chunks,
+// each from its own seed derived from the corpus seed and the chunk index,
+// so a corpus is identical whatever the thread count or output format.
+// Distances and times are quantised to 10 m and 6 s so the CSV text reads
+// back as exactly the doubles written to a columnar file.
+// ---------------------------------------------------------------------------
+
+struct CorpusSpec {
+    uint64_t seed = 1;
+    double distanceMedianKm = 6.0;   // log-normal trip length
+    double distanceSigma = 0.8;      // spread of log(distance)
+    double speedMinKmh = 12.0;       // average speed is uniform in [min, max]
+    double speedMaxKmh = 45.0;
+    double vehicleMix[3] = {60, 15, 25};   // weights for vehicles 1, 2 and 3
+    double peakFraction = 0.35;
+    double promoHitRatio = 0.20;     // share of trips with a valid promo code
+};
+
+// A spec turned into integer thresholds for the per-row draws
+struct CorpusPlan {
+    CorpusSpec spec;
+    uint32_t vehicleCut[3];   // vehicle v + 1 when draw < vehicleCut[v]
+    uint32_t peakCut;
+    uint32_t promoCut;
+    uint32_t promoCount;      // valid promo ids are 1 .. promoCount
+};
+
+// Throws std::invalid_argument if the spec is out of range or gives weight
+// to a vehicle the tables do not know
+static CorpusPlan planCorpus(const CorpusSpec &spec, const FareTables &tables) {
+    auto fraction = [](double f) { return f >= 0 && f <= 1; };
+    if (!(spec.distanceMedianKm > 0 && spec.distanceMedianKm <= kMaxDistanceKm) ||
+        !(spec.distanceSigma >= 0 && spec.distanceSigma <= 4) ||
+        !(spec.speedMinKmh > 0 && spec.speedMinKmh <= spec.speedMaxKmh) ||
+        !fraction(spec.peakFraction) || !fraction(spec.promoHitRatio)) {
+        throw std::invalid_argument("corpus parameters out of range");
+    }
+    double total = 0;
+    for (size_t v = 0; v < 3; ++v) {
+        if (!(spec.vehicleMix[v] >= 0)) throw std::invalid_argument("vehicle weights must be non-negative");
+        if (spec.vehicleMix[v] > 0 && (v + 1 >= tables.vehicleKnown.size() || !tables.vehicleKnown[v + 1])) {
+            throw std::invalid_argument("unknown vehicle " + std::to_string(v + 1) + " in mix");
+        }
+        total += spec.vehicleMix[v];
+    }
+    if (!(total > 0)) throw std::invalid_argument("vehicle mix is empty");
+
+    auto cut = [](double f) { return static_cast<uint32_t>(std::min(f * 4294967296.0, 4294967295.0)); };
+    CorpusPlan plan{};
+    plan.spec = spec;
+    double running = 0;
+    for (size_t v = 0; v < 3; ++v) {
+        running += spec.vehicleMix[v];
+        plan.vehicleCut[v] = cut(running / total);
+    }
+    plan.vehicleCut[2] = 0xFFFFFFFFu;
+    plan.peakCut = cut(spec.peakFraction);
+    plan.promoCount = static_cast<uint32_t>(tables.promos.size() - 1);
+    plan.promoCut = plan.promoCount > 0 ? cut(spec.promoHitRatio) : 0;
+    return plan;
+}
+
+// Fill count rows of chunk number chunk into the given columns
+static void generateCorpusChunk(const CorpusPlan &plan, size_t chunk, size_t count, double *distanceKm,
+                                double *timeMin, uint8_t *vehicleId, uint8_t *isPeak, uint16_t *promoId) {
+    const CorpusSpec &spec = plan.spec;
+    uint64_t state = mix64(spec.seed ^ mix64(chunk + 1));
+    auto next = [&state] { state = mix64(state + 0x9E3779B97F4A7C15ULL); return state; };
+    const double logMedian = std::log(spec.distanceMedianKm);
+    const double speedSpan = spec.speedMaxKmh - spec.speedMinKmh;
+    for (size_t i = 0; i < count; ++i) {
+        // Four 16-bit uniforms summed approximate a unit normal (Irwin-Hall)
+        uint64_t r = next();
+        double sum = static_cast<double>((r & 0xFFFF) + (r >> 16 & 0xFFFF) + (r >> 32 & 0xFFFF) + (r >> 48));
+        double z = (sum / 65536.0 - 2.0) * 1.7320508075688772;
+        double km = std::exp(logMedian + spec.distanceSigma * z);
+        km = std::round(std::min(std::max(km, 0.3), kMaxDistanceKm) * 100.0) / 100.0;
+
+        uint64_t s = next();
+        double speed = spec.speedMinKmh + speedSpan * static_cast<double>(s & 0xFFFFFFFFu) / 4294967296.0;
+        double waitMin = 4.0 * static_cast<double>(s >> 32) / 4294967296.0;
+        double minutes = std::min(km / speed * 60.0 + waitMin, kMaxTimeMin);
+
+        uint64_t c = next();
+        uint32_t vehicleDraw = static_cast<uint32_t>(c);
+        uint32_t peakDraw = static_cast<uint32_t>(c >> 32);
+        uint64_t p = next();
+        uint32_t promoDraw = static_cast<uint32_t>(p);
+
+        distanceKm[i] = km;
+        timeMin[i] = std::round(minutes * 10.0) / 10.0;
+        vehicleId[i] = static_cast<uint8_t>(vehicleDraw < plan.vehicleCut[0] ? 1
+                                            : vehicleDraw < plan.vehicleCut[1] ? 2 : 3);
+        isPeak[i] = static_cast<uint8_t>(peakDraw < plan.peakCut);
+        promoId[i] = static_cast<uint16_t>(
+            promoDraw < plan.promoCut ? 1 + (p >> 32) % plan.promoCount : 0);
+    }
+}
+
+// Parse "--option value" pairs after the path and row count.  List values
+// are comma separated.  Returns false on an unknown option or bad number.
+static bool parseCorpusOptions(int argc, char **argv, int first, CorpusSpec &spec, unsigned &threads) {
+    auto parseList = [](std::string_view text, double *out, size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            size_t comma = text.find(',');
+            if ((comma == std::string_view::npos) != (i + 1 == n)) return false;
+            if (!parseNumber(text.substr(0, comma), out[i])) return false;
+            text.remove_prefix(i + 1 == n ? text.size() : comma + 1);
+        }
+        return true;
+    };
+    for (int i = first; i < argc; i += 2) {
+        if (i + 1 >= argc) return false;
+        std::string_view option = argv[i], value = argv[i + 1];
+        double number[3];
+        bool ok;
+        if (option == "--seed") {
+            ok = parseList(value, number, 1) && number[0] >= 0 && number[0] == std::floor(number[0]);
+            if (ok) spec.seed = static_cast<uint64_t>(number[0]);
+        } else if (option == "--distance") {
+            ok = parseList(value, number, 2);
+            if (ok) spec.distanceMedianKm = number[0], spec.distanceSigma = number[1];
+        } else if (option == "--speed") {
+            ok = parseList(value, number, 2);
+            if (ok) spec.speedMinKmh = number[0], spec.speedMaxKmh = number[1];
+        } else if (option == "--mix") {
+            ok = parseList(value, spec.vehicleMix, 3);
+        } else if (option == "--peak") {
+            ok = parseList(value, &spec.peakFraction, 1);
+        } else if (option == "--promo-hit") {
+            ok = parseList(value, &spec.promoHitRatio, 1);
+        } else if (option == "--threads") {
+            ok = parseList(value, number, 1) && number[0] >= 0 && number[0] <= 4096;
+            if (ok) threads = static_cast<unsigned>(number[0]);
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            std::cerr << "bad option " << option << ' ' << value << '\n';
+            return false;
+        }
+    }
+    return true;
+}
+
+// Write rows trips to path, as CSV if it ends in ".csv" and as a columnar
+// trip file otherwise, using the given number of threads (0 = one per core)
+int runGenerateMode(const FareTables &tables, const char *path, uint64_t rows, const CorpusSpec &spec,
+                    unsigned threads) {
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    auto start = std::chrono::steady_clock::now();
+    try {
+        CorpusPlan plan = planCorpus(spec, tables);
+        const size_t chunkRows = kParallelChunkRows;
+        size_t chunkCount = static_cast<size_t>((rows + chunkRows - 1) / chunkRows);
+        std::string_view name = path;
+        bool csv = name.size() >= 4 && name.substr(name.size() - 4) == ".csv";
+
+        if (!csv) {
+            ColumnarWriter out(path, kTripFileMagic, kTripFileColumns, rows, tables.promos.codes());
+            double *distanceKm = out.column<double>(kColDistanceKm);
+            double *timeMin = out.column<double>(kColTimeMin);
+            uint8_t *vehicleId = out.column<uint8_t>(kColVehicleId);
+            uint8_t *isPeak = out.column<uint8_t>(kColIsPeak);
+            uint16_t *promoId = out.column<uint16_t>(kColPromoId);
+            runChunks(chunkCount, threads, [&](size_t chunk) {
+                size_t begin = chunk * chunkRows;
+                size_t count = static_cast<size_t>(std::min<uint64_t>(chunkRows, rows - begin));
+                generateCorpusChunk(plan, chunk, count, distanceKm + begin, timeMin + begin,
+                                    vehicleId + begin, isPeak + begin, promoId + begin);
+            });
+        } else {
+            int fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0) throw std::runtime_error(string("cannot create ") + path + ": " + std::strerror(errno));
+            std::vector<string> codes = tables.promos.codes();
+            {
+                BufferedWriter out(fd);
+                out.append("vehicle,distance_km,time_min,peak,promo\n");
+
+                // Chunks are formatted in parallel a window at a time and
+                // written in order
+                const size_t window = static_cast<size_t>(threads) * 4;
+                std::vector<TripBatch> batches;
+                for (size_t k = 0; k < window; ++k) batches.emplace_back(chunkRows);
+                std::vector<string> text(window);
+                for (size_t first = 0; first < chunkCount; first += window) {
+                    size_t n = std::min(window, chunkCount - first);
+                    runChunks(n, threads, [&](size_t k) {
+                        TripBatch &batch = batches[k];
+                        size_t chunk = first + k;
+                        size_t begin = chunk * chunkRows;
+                        batch.count = static_cast<size_t>(std::min<uint64_t>(chunkRows, rows - begin));
+                        generateCorpusChunk(plan, chunk, batch.count, batch.distanceKm.data(),
+                                            batch.timeMin.data(), batch.vehicleId.data(),
+                                            batch.isPeak.data(), batch.promoId.data());
+                        string &line = text[k];
+                        line.clear();
+                        char tmp[32];
+                        for (size_t i = 0; i < batch.count; ++i) {
+                            line += static_cast<char>('0' + batch.vehicleId[i]);
+                            line += ',';
+                            line.append(tmp, std::to_chars(tmp, tmp + sizeof tmp, batch.distanceKm[i]).ptr);
+                            line += ',';
+                            line.append(tmp, std::to_chars(tmp, tmp + sizeof tmp, batch.timeMin[i]).ptr);
+                            line += batch.isPeak[i] ? ",1" : ",0";
+                            if (batch.promoId[i] != 0) {
+                                line += ',';
+                                line += codes[batch.promoId[i]];
+                            }
+                            line += '\n';
+                        }
+                    });
+                    for (size_t k = 0; k < n; ++k) out.append(text[k]);
+                }
+            }
+            if (::close(fd) != 0) throw std::runtime_error(string("cannot close ") + path);
+        }
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    cout << "wrote " << rows << " trips to " << path << " in " << std::fixed << std::setprecision(3)
+         << elapsed.count() << " s (" << std::setprecision(1) << rows / elapsed.count() / 1e6
+         << " Mrows/s)\n";
+    return 0;
+}
+
+// Fill a batch with reproducible pseudo-random trips of one vehicle class
+static void fillSyntheticTrips(TripBatch &batch, uint8_t vehicle, size_t promoCount, uint64_t seed) {
+    uint64_t state = seed;
+    auto next = [&state] { state = mix64(state + 0x9E3779B97F4A7C15ULL); return state; };
+    batch.count = batch.capacity();
+    for (size_t i = 0; i < batch.count; ++i) {
+        batch.distanceKm[i] = 0.5 + static_cast<double>(next() % 40000) / 1000.0;
+        batch.timeMin[i] = 2.0 + static_cast<double>(next() % 9000) / 100.0;
+        batch.vehicleId[i] = vehicle;
+        batch.isPeak[i] = static_cast<uint8_t>(next() & 1);
+        batch.promoId[i] = static_cast<uint16_t>(next() % (promoCount + 1));   // includes a miss
+    }
+}
+
+// Compare the generic batch path with the per-vehicle specialised one
+int runVehicleBenchMode(const FareTables &tables, size_t rows) {
+    if (rows == 0) {
+        std::cerr << "ROWS must be a positive number\n";
+        return 2;
+    }
+    struct Case {
+        Vehicle vehicle;
+        const char *name;
+        void (*specialised)(const TripColumns &, const FareTables &, const FareColumns &, SimdLevel);
+    };
+    static const Case cases[] = {
+        {Vehicle::Economy, "economy", computeFareBatchAs<Vehicle::Economy>},
+        {Vehicle::Premium, "premium", computeFareBatchAs<Vehicle::Premium>},
+        {Vehicle::Bike, "bike", computeFareBatchAs<Vehicle::Bike>},
+    };
+    TripBatch batch(rows);
+    FareBatch fares(rows);
+    FareColumns out = fares.columns();
+
+    auto bestOf = [&](auto &&run) {
+        double best = std::numeric_limits<double>::max();
+        for (int rep = 0; rep < 5; ++rep) {
+            auto start = std::chrono::steady_clock::now();
+            run();
+            std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+            best = std::min(best, elapsed.count() / static_cast<double>(rows));
+        }
+        return best;
+    };
+
+    cout << "rows: " << rows << "\n";
+    cout << "vehicle  simd     generic ns/trip  specialised ns/trip  gain\n";
+    for (const Case &c : cases) {
+        fillSyntheticTrips(batch, static_cast<uint8_t>(c.vehicle), tables.promos.size(), 42);
+        TripColumns trips = batch.columns();
+        for (SimdLevel level : {SimdLevel::Scalar, SimdLevel::Avx2, SimdLevel::Avx512}) {
+            if (level > supportedSimdLevel()) continue;
+            double generic = bestOf([&] { computeFareBatchWith(level, trips, tables, out); });
+            double specialised = bestOf([&] { c.specialised(trips, tables, out, level); });
+            cout << std::left << std::setw(9) << c.name << std::setw(9) << simdLevelName(level) << std::right
+                 << std::fixed << std::setprecision(2) << std::setw(15) << generic
+                 << std::setw(21) << specialised << std::setw(7) << generic / specialised << "x\n";
+        }
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Microbenchmark suite.  Each case is calibrated to run for at least ~50 ms,
+// measured three times and the fastest run kept.  Allocations the calling
+// thread makes during the timed runs, aligned ones included, are counted by
+// the replacement operator new at the top of the file; cases run on one
+// thread, so allocs/op is exact.  Results go to stdout as a table and optionally to a JSON file for
+// diffing builds.
+// ---------------------------------------------------------------------------
+
+struct BenchResult {
+    string name;
+    double nsPerOp;
+    double opsPerSec;
+    double allocsPerOp;
+};
+
+// Keep the compiler from discarding a value computed in a benchmark loop
+template <typename T>
+static inline void doNotOptimize(const T &value) {
+    asm volatile("" : : "m"(value) : "memory");
+}
+
+// Stream buffer that discards everything, for timing formatting alone
+class NullBuffer : public std::streambuf {
+protected:
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(const char *, std::streamsize n) override { return n; }
+};
+
+// Time run(iterations), where each call performs opsPerIteration operations
+template <typename Fn>
+static BenchResult measure(const string &name, size_t opsPerIteration, Fn &&run) {
+    using Clock = std::chrono::steady_clock;
+    size_t iterations = 1;
+    while (true) {
+        auto start = Clock::now();
+        run(iterations);
+        if (Clock::now() - start >= std::chrono::milliseconds(50) || iterations >= (size_t{1} << 40)) break;
+        iterations *= 2;
+    }
+    BenchResult result{name, std::numeric_limits<double>::max(), 0, 0};
+    for (int rep = 0; rep < 3; ++rep) {
+        uint64_t allocsBefore = tAllocationCount;
+        tCountAllocations = true;
+        auto start = Clock::now();
+        run(iterations);
+        std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+        tCountAllocations = false;
+        uint64_t allocs = tAllocationCount - allocsBefore;
+        double ops = static_cast<double>(iterations) * static_cast<double>(opsPerIteration);
+        if (elapsed.count() / ops < result.nsPerOp) {
+            result.nsPerOp = elapsed.count() / ops;
+            result.allocsPerOp = static_cast<double>(allocs) / ops;
+        }
+    }
+    result.opsPerSec = 1e9 / result.nsPerOp;
+    return result;
+}
+
+// Run every case whose name contains filter; write JSON to jsonPath if set
+int runBenchSuite(const FareTables &tables, const string &filter, const char *jsonPath) {
+    std::vector<BenchResult> results;
+    auto wanted = [&](const string &name) { return name.find(filter) != string::npos; };
+
+    // Small rotating input sets so no case prices the same constant
+    constexpr size_t kInputs = 64;
+    double distances[kInputs], times[kInputs];
+    for (size_t i = 0; i < kInputs; ++i) {
+        distances[i] = 0.8 + static_cast<double>(mix64(i) % 30000) / 1000.0;
+        times[i] = 3.0 + static_cast<double>(mix64(i + 1000) % 6000) / 100.0;
+    }
+
+    struct VehicleCase { Vehicle vehicle; const char *name; };
+    static const VehicleCase vehicles[] = {
+        {Vehicle::Economy, "economy"}, {Vehicle::Premium, "premium"}, {Vehicle::Bike, "bike"}};
+
+    for (const VehicleCase &v : vehicles) {
+        const Rates &rates = tables.ratesById.at(static_cast<size_t>(v.vehicle));
+        for (bool peak : {false, true}) {
+            for (const char *promo : {"GRAB10", "NOSUCHCODE"}) {
+                string name = string("computeFare/") + v.name + (peak ? "/peak" : "/offpeak") +
+                              (std::strcmp(promo, "GRAB10") == 0 ? "/promo-hit" : "/promo-miss");
+                if (!wanted(name)) continue;
+                results.push_back(measure(name, 1, [&](size_t n) {
+                    for (size_t i = 0; i < n; ++i) {
+                        FareBreakdown fb = computeFare(distances[i % kInputs], times[i % kInputs], peak, promo,
+                                                       rates, tables.peakMultiplier, tables.minFare, tables.promos);
+                        doNotOptimize(fb);
+                    }
+                }));
+            }
+        }
+    }
+
+    struct CodeCase { const char *name; const char *code; };
+    static const CodeCase codes[] = {
+        {"exact", "GRAB10"}, {"lower-padded", "  student15 "}, {"miss", "NOSUCHCODE"},
+        {"too-long", "THIS-CODE-IS-FAR-TOO-LONG"}};
+    for (const CodeCase &c : codes) {
+        string name = string("foldPromoKey/") + c.name;
+        if (wanted(name)) {
+            std::string_view code = c.code;
+            results.push_back(measure(name, 1, [&](size_t n) {
+                for (size_t i = 0; i < n; ++i) {
+                    PromoKey key{};
+                    bool ok = foldPromoKey(code, key);
+                    doNotOptimize(key);
+                    doNotOptimize(ok);
+                    doNotOptimize(code);
+                }
+            }));
+        }
+        name = string("promoLookup/") + c.name;
+        if (wanted(name)) {
+            std::string_view code = c.code;
+            results.push_back(measure(name, 1, [&](size_t n) {
+                for (size_t i = 0; i < n; ++i) {
+                    uint16_t id = tables.promos.find(code);
+                    doNotOptimize(id);
+                    doNotOptimize(code);
+                }
+            }));
+        }
+    }
+
+    // A cache big enough for every input, and one small enough that most
+    // lookups miss and insert
+    for (bool fits : {true, false}) {
+        string name = string("quoteCache/") + (fits ? "hit" : "miss");
+        if (!wanted(name)) continue;
+        QuoteCache cache(fits ? 4 * kInputs : 4, QuoteCache::Quantum{});
+        results.push_back(measure(name, 1, [&](size_t n) {
+            bool hit;
+            for (size_t i = 0; i < n; ++i) {
+                FareBreakdown fb = cache.quote(tables, 1, distances[i % kInputs], times[i % kInputs], 1, 1, hit);
+                doNotOptimize(fb);
+            }
+        }));
+    }
+
+    // Start times spread over a year, holidays included
+    if (wanted("peakCalendar/tierAt")) {
+        std::vector<int64_t> starts(kInputs);
+        for (size_t i = 0; i < kInputs; ++i) starts[i] = 1767225600 + static_cast<int64_t>(i) * 7919 * 60;
+        results.push_back(measure("peakCalendar/tierAt", 1, [&](size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+                uint8_t tier = tables.calendar.tierAt(starts[i % kInputs]);
+                doNotOptimize(tier);
+            }
+        }));
+    }
+
+    // City trips around Kuala Lumpur, a batch per call
+    {
+        auto jitter = [](uint64_t key) { return static_cast<double>(mix64(key) % 40000) / 100000.0 - 0.2; };
+        CoordBatch points(kBatchRows);
+        for (size_t i = 0; i < kBatchRows; ++i) {
+            points.pickupLat[i] = 3.14 + jitter(4 * i);
+            points.pickupLon[i] = 101.69 + jitter(4 * i + 1);
+            points.dropoffLat[i] = 3.14 + jitter(4 * i + 2);
+            points.dropoffLon[i] = 101.69 + jitter(4 * i + 3);
+        }
+        std::vector<double> distanceKm(kBatchRows);
+        for (DistanceModel model : {DistanceModel::Haversine, DistanceModel::Equirectangular}) {
+            for (SimdLevel level : {SimdLevel::Scalar, SimdLevel::Avx2, SimdLevel::Avx512}) {
+                if (level > supportedSimdLevel()) continue;
+                string name = string("distance/") +
+                              (model == DistanceModel::Haversine ? "haversine/" : "equirectangular/") +
+                              simdLevelName(level);
+                if (!wanted(name)) continue;
+                results.push_back(measure(name, kBatchRows, [&](size_t n) {
+                    for (size_t i = 0; i < n; ++i) {
+                        computeDistanceBatchWith(level, points.columns(kBatchRows), model, distanceKm.data());
+                    }
+                }));
+            }
+        }
+    }
+
+    // A city trace with a ping every two seconds and some parked stretches;
+    // ops are pings, segment measurement and filter together
+    {
+        constexpr size_t kPings = 4096;
+        std::vector<double> lat(kPings), lon(kPings), seconds(kPings), segmentKm(kPings);
+        double heading = 0;
+        for (size_t i = 0; i < kPings; ++i) {
+            bool parked = mix64(i) % 5 == 0;
+            heading += static_cast<double>(mix64(i + kPings) % 1000) / 2500.0 - 0.2;
+            double step = parked ? 0 : static_cast<double>(mix64(i + 2 * kPings) % 300) / 1e6;
+            lat[i] = (i ? lat[i - 1] : 3.14) + step * std::cos(heading);
+            lon[i] = (i ? lon[i - 1] : 101.69) + step * std::sin(heading);
+            seconds[i] = 2.0 * static_cast<double>(i);
+        }
+        TraceColumns pings{lat.data(), lon.data(), seconds.data(), kPings};
+        for (SimdLevel level : {SimdLevel::Scalar, SimdLevel::Avx2, SimdLevel::Avx512}) {
+            if (level > supportedSimdLevel()) continue;
+            string name = string("trace/") + simdLevelName(level);
+            if (!wanted(name)) continue;
+            results.push_back(measure(name, kPings, [&](size_t n) {
+                for (size_t i = 0; i < n; ++i) {
+                    computeTraceSegmentsWith(level, pings, segmentKm.data());
+                    TraceDistance d = filterTrace(pings, segmentKm.data(), 0, kPings);
+                    doNotOptimize(d);
+                }
+            }));
+        }
+    }
+
+    // One meter fed the same city trace, then asked for its fare
+    {
+        constexpr size_t kPings = 4096;
+        std::vector<double> lat(kPings), lon(kPings);
+        for (size_t i = 0; i < kPings; ++i) {
+            lat[i] = 3.14 + static_cast<double>(i) * 1e-4 + static_cast<double>(mix64(i) % 100) * 1e-6;
+            lon[i] = 101.69 + static_cast<double>(mix64(i + kPings) % 100) * 1e-6;
+        }
+        FareMeter meter(std::make_shared<const FareTables>(tables), 1, 1792137600, "GRAB10");
+        if (wanted("fareMeter/addPing")) {
+            double now = 1792137600;
+            results.push_back(measure("fareMeter/addPing", 1, [&](size_t n) {
+                for (size_t i = 0; i < n; ++i) {
+                    now += 2;
+                    meter.addPing(lat[i % kPings], lon[i % kPings], now);
+                }
+            }));
+        }
+        if (wanted("fareMeter/breakdown")) {
+            results.push_back(measure("fareMeter/breakdown", 1, [&](size_t n) {
+                for (size_t i = 0; i < n; ++i) {
+                    meter.tick(1792137600 + static_cast<double>(i));
+                    FareBreakdown fb = meter.breakdown();
+                    doNotOptimize(fb);
+                }
+            }));
+        }
+    }
+
+    for (bool peak : {false, true}) {
+        string name = string("printBreakdown/") + (peak ? "peak-promo" : "offpeak-none");
+        if (!wanted(name)) continue;
+        FareBreakdown fb = computeFare(12.3, 25.0, peak, peak ? "SUPER20" : "NONE", tables.ratesById.at(1),
+                                       tables.peakMultiplier, tables.minFare, tables.promos);
+        NullBuffer sink;
+        std::ostream os(&sink);
+        results.push_back(measure(name, 1, [&](size_t n) {
+            for (size_t i = 0; i < n; ++i) printBreakdown(fb, tables.promos, os);
+        }));
+    }
+
+    TripBatch batch(kBatchRows);
+    FareBatch fares(kBatchRows);
+    FareColumns out = fares.columns();
+    for (const VehicleCase &v : vehicles) {
+        fillSyntheticTrips(batch, static_cast<uint8_t>(v.vehicle), tables.promos.size(), 7);
+        TripColumns trips = batch.columns();
+        string fixedName = string("batchFixed/") + v.name;
+        if (wanted(fixedName)) {
+            FareTablesSen tablesSen = toFixedPoint(tables);
+            results.push_back(measure(fixedName, batch.count, [&](size_t n) {
+                for (size_t i = 0; i < n; ++i) computeFareBatch(trips, tablesSen, out);
+            }));
+        }
+        for (SimdLevel level : {SimdLevel::Scalar, SimdLevel::Avx2, SimdLevel::Avx512}) {
+            if (level > supportedSimdLevel()) continue;
+            string name = string("batch/") + v.name + "/" + simdLevelName(level);
+            if (wanted(name)) {
+                results.push_back(measure(name, batch.count, [&](size_t n) {
+                    for (size_t i = 0; i < n; ++i) computeFareBatchWith(level, trips, tables, out);
+                }));
+            }
+            name = string("batchSpecialised/") + v.name + "/" + simdLevelName(level);
+            if (!wanted(name)) continue;
+            results.push_back(measure(name, batch.count, [&](size_t n) {
+                for (size_t i = 0; i < n; ++i) {
+                    switch (v.vehicle) {
+                        case Vehicle::Economy: computeFareBatchAs<Vehicle::Economy>(trips, tables, out, level); break;
+                        case Vehicle::Premium: computeFareBatchAs<Vehicle::Premium>(trips, tables, out, level); break;
+                        case Vehicle::Bike: computeFareBatchAs<Vehicle::Bike>(trips, tables, out, level); break;
+                    }
+                }
+            }));
+        }
+    }
+
+    cout << std::left << std::setw(44) << "case" << std::right << std::setw(12) << "ns/op"
+         << std::setw(16) << "ops/s" << std::setw(12) << "allocs/op" << '\n';
+    for (const BenchResult &r : results) {
+        cout << std::left << std::setw(44) << r.name << std::right << std::fixed
+             << std::setprecision(2) << std::setw(12) << r.nsPerOp
+             << std::setprecision(0) << std::setw(16) << r.opsPerSec
+             << std::setprecision(3) << std::setw(12) << r.allocsPerOp << '\n';
+    }
+
+    if (jsonPath != nullptr) {
+        std::ofstream json(jsonPath);
+        if (!json) {
+            std::cerr << "cannot write " << jsonPath << '\n';
+            return 1;
+        }
+        json << std::fixed << "{\n  \"version\": 1,\n  \"simd\": \"" << simdLevelName(supportedSimdLevel())
+             << "\",\n  \"results\": [\n";
+        for (size_t i = 0; i < results.size(); ++i) {
+            const BenchResult &r = results[i];
+            json << "    {\"name\": \"" << r.name << "\", \"ns_per_op\": " << std::setprecision(3) << r.nsPerOp
+                 << ", \"ops_per_sec\": " << std::setprecision(0) << r.opsPerSec
+                 << ", \"allocs_per_op\": " << std::setprecision(4) << r.allocsPerOp << "}"
+                 << (i + 1 < results.size() ? ",\n" : "\n");
+        }
+        json << "  ]\n}\n";
+    }
+    return 0;
+}
+
+// Command-line help for the headless modes
+static void printUsage(const char *argv0) {
+    std::cerr << "Usage: " << argv0 << "                 interactive calculator\n"
+              << "       " << argv0 << " --csv [FILE|-] [--profile|--fixed]  price CSV trips to stdout;\n"
+              << "           --profile prints per-stage latency percentiles to stderr,\n"
+              << "           --fixed prices in integer sen with the fixed-point engine\n"
+              << "       " << argv0 << " --compare-fixed [FILE|-]  compare fixed-point and double prices\n"
+              << "       " << argv0 << " --coords [FILE|-] [--equirectangular]  price CSV trips given as\n"
+              << "           coordinates, measured great-circle unless --equirectangular\n"
+              << "       " << argv0 << " --trace [FILE|-]  price trips from GPS pings trip,vehicle,time,lat,lon,promo\n"
+              << "       " << argv0 << " --receipts [FILE|-]  print a full receipt for every CSV trip\n"
+              << "       " << argv0 << " --pack CSV OUT   convert CSV trips to a columnar trip file\n"
+              << "       " << argv0 << " --price-bin IN OUT [--fixed]  price a columnar trip file into a fare file\n"
+              << "       " << argv0 << " --dump FILE      print a columnar trip or fare file as CSV\n"
+              << "       " << argv0 << " --compile-rates RATES OUT  compile a rate card for fast loading\n"
+              << "       " << argv0 << " --scaling FILE [THREADS]  time parallel pricing from 1 to THREADS\n"
+              << "       " << argv0 << " --bench-vehicles [ROWS]   generic vs per-vehicle specialised pricing\n"
+              << "       " << argv0 << " --serve PORT [LOOPS] [--batch-window US] [--batch-max N]\n"
+              << "           [--cache ENTRIES] [--cache-quantum KM,MIN]\n"
+              << "           [--surge CELLS] [--surge-tick MS] [--surge-window TICKS]\n"
+              << "           serve CSV quotes over TCP on 127.0.0.1, pricing in micro-batches;\n"
+              << "           --cache prices trips rounded to the quantum and reuses the fares;\n"
+              << "           --surge prices trips that give a cell with that cell's multiplier\n"
+              << "       " << argv0 << " --surge-sim [SECONDS] [THREADS]  simulate surge pricing on a grid\n"
+              << "       " << argv0 << " --serve-shm NAME [SLOTS] [THREADS]  serve quotes over shared memory\n"
+              << "       " << argv0 << " --shm-quote NAME [FILE|-]  price CSV trips through a --serve-shm server\n"
+              << "       " << argv0 << " --bench [FILTER] [--json FILE]  run the microbenchmark suite\n"
+              << "       " << argv0 << " --generate OUT ROWS [OPTIONS]  write a synthetic trip corpus\n"
+              << "           (CSV if OUT ends in .csv, else a trip file)  --seed N  --distance MEDIAN_KM,SIGMA\n"
+              << "           --speed MIN_KMH,MAX_KMH  --mix ECONOMY,PREMIUM,BIKE  --peak FRACTION\n"
+              << "           --promo-hit FRACTION  --threads N\n"
+              << "\nCSV input: vehicle,distance_km,time_min,peak,promo,cell  (vehicle 1-3; peak 0,\n"
+              << "1, a higher calendar tier or a start time like 2026-10-16T08:15; promo and cell\n"
+              << "optional); with --coords,\n"
+              << "vehicle,pickup_lat,pickup_lon,dropoff_lat,dropoff_lon,time_min,peak,promo,cell\n"
+              << "Put --rates FILE before any mode to replace the built-in rate card; the serve\n"
+              << "modes reload it on SIGHUP.\n";
+}
+
+int main(int argc, char **argv) {
+    // --rates FILE replaces the built-in rate card in every mode
+    const char *ratesPath = nullptr;
+    if (argc >= 3 && std::strcmp(argv[1], "--rates") == 0) {
+        ratesPath = argv[2];
+        argv[2] = argv[0];
+        argv += 2;
+        argc -= 2;
+    }
+    std::unique_ptr<RateCardStore> store;
+    try {
+        store = std::make_unique<RateCardStore>(ratesPath != nullptr ? loadFareTables(ratesPath)
+                                                                     : buildFareTables(defaultRateCard()));
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
+    // Only the serve modes ever swap the card, and they use the store
+    const FareTables &tables = store->current();
+
+    // Headless modes
+    if (argc > 1) {
+        string mode = argv[1];
+        if (mode == "--csv" && argc <= 4) {
+            bool profile = argc >= 3 && std::strcmp(argv[argc - 1], "--profile") == 0;
+            bool fixed = argc >= 3 && std::strcmp(argv[argc - 1], "--fixed") == 0;
+            int args = argc - (profile || fixed ? 1 : 0);
+            if (args <= 3) return runCsvMode(tables, args == 3 ? argv[2] : nullptr, profile, fixed);
+        }
+        if (mode == "--compare-fixed" && argc <= 3) {
+            return runCompareFixedMode(tables, argc == 3 ? argv[2] : nullptr);
+        }
+        if (mode == "--coords" && argc <= 4) {
+            bool flat = argc >= 3 && std::strcmp(argv[argc - 1], "--equirectangular") == 0;
+            int args = argc - (flat ? 1 : 0);
+            if (args <= 3) {
+                return runCoordsMode(tables, args == 3 ? argv[2] : nullptr,
+                                     flat ? DistanceModel::Equirectangular : DistanceModel::Haversine);
+            }
+        }
+        if (mode == "--trace" && argc <= 3) return runTraceMode(tables, argc == 3 ? argv[2] : nullptr);
+        if (mode == "--receipts" && argc <= 3) return runReceiptsMode(tables, argc == 3 ? argv[2] : nullptr);
+        if (mode == "--pack" && argc == 4) return runPackMode(tables, argv[2], argv[3]);
+        if (mode == "--price-bin" && (argc == 4 || (argc == 5 && std::strcmp(argv[4], "--fixed") == 0))) {
+            return runPriceBinMode(tables, argv[2], argv[3], argc == 5);
+        }
+        if (mode == "--dump" && argc == 3) return runDumpMode(argv[2]);
+        if (mode == "--compile-rates" && argc == 4) return runCompileRatesMode(argv[2], argv[3]);
+        if (mode == "--bench") {
+            string filter;
+            const char *jsonPath = nullptr;
+            for (int i = 2; i < argc; ++i) {
+                if (std::strcmp(argv[i], "--json") == 0 && i + 1 < argc) jsonPath = argv[++i];
+                else filter = argv[i];
+            }
+            return runBenchSuite(tables, filter, jsonPath);
+        }
+        if (mode == "--generate" && argc >= 4) {
+            CorpusSpec spec;
+            unsigned threads = 0;
+            double rows;
+            if (parseNumber(argv[3], rows) && rows >= 0 && rows == std::floor(rows) &&
+                parseCorpusOptions(argc, argv, 4, spec, threads)) {
+                return runGenerateMode(tables, argv[2], static_cast<uint64_t>(rows), spec, threads);
+            }
+        }
+        if (mode == "--serve" && argc >= 3) {
+            double port, number;
+            unsigned loops = 0;
+            QuoteBatchPolicy policy;
+            size_t cacheEntries = 0;
+            QuoteCache::Quantum quantum;
+            double surgeCells = 0;
+            SurgeEngine::Config surgeConfig;
+            bool ok = parseNumber(argv[2], port) && port >= 0 && port <= 65535 && port == std::floor(port);
+            int i = 3;
+            if (ok && i < argc && argv[i][0] != '-') loops = static_cast<unsigned>(std::atoi(argv[i++]));
+            for (; ok && i < argc; i += 2) {
+                ok = i + 1 < argc;
+                if (ok && std::strcmp(argv[i], "--cache-quantum") == 0) {
+                    std::string_view value = argv[i + 1];
+                    size_t comma = value.find(',');
+                    ok = comma != std::string_view::npos && parseNumber(value.substr(0, comma), quantum.km) &&
+                         parseNumber(value.substr(comma + 1), quantum.min);
+                    continue;
+                }
+                ok = ok && parseNumber(argv[i + 1], number) && number >= 0 && number <= 1e9 &&
+                     number == std::floor(number);
+                if (ok && std::strcmp(argv[i], "--batch-window") == 0 && number <= 1e6) {
+                    policy.window = std::chrono::microseconds(static_cast<long>(number));
+                } else if (ok && std::strcmp(argv[i], "--batch-max") == 0 && number >= 1 && number <= 1e6) {
+                    policy.maxRows = static_cast<size_t>(number);
+                } else if (ok && std::strcmp(argv[i], "--cache") == 0) {
+                    cacheEntries = static_cast<size_t>(number);
+                } else if (ok && std::strcmp(argv[i], "--surge") == 0) {
+                    surgeCells = number;
+                } else if (ok && std::strcmp(argv[i], "--surge-tick") == 0) {
+                    surgeConfig.tick = std::chrono::milliseconds(static_cast<long>(number));
+                } else if (ok && std::strcmp(argv[i], "--surge-window") == 0) {
+                    surgeConfig.windowTicks = static_cast<unsigned>(number);
+                } else {
+                    ok = false;
+                }
+            }
+            if (ok) {
+                std::unique_ptr<QuoteCache> cache;
+                std::unique_ptr<SurgeEngine> surge;
+                try {
+                    if (cacheEntries > 0) cache = std::make_unique<QuoteCache>(cacheEntries, quantum);
+                    if (surgeCells > 0) {
+                        surge = std::make_unique<SurgeEngine>(static_cast<uint32_t>(surgeCells), surgeConfig);
+                    }
+                } catch (const std::exception &e) {
+                    std::cerr << e.what() << '\n';
+                    return 2;
+                }
+                return runServeMode(*store, ratesPath, static_cast<uint16_t>(port), loops, policy, cache.get(),
+                                    surge.get());
+            }
+        }
+        if (mode == "--surge-sim" && argc <= 4) {
+            double seconds = 5;
+            if (argc >= 3 && !parseNumber(argv[2], seconds)) seconds = 0;
+            return runSurgeSimMode(tables, seconds, argc == 4 ? static_cast<unsigned>(std::atoi(argv[3])) : 0);
+        }
+        if (mode == "--serve-shm" && argc >= 3 && argc <= 5) {
+            return runShmServeMode(*store, ratesPath, argv[2],
+                                   argc >= 4 ? static_cast<uint32_t>(std::strtoul(argv[3], nullptr, 10)) : 0,
+                                   argc == 5 ? static_cast<unsigned>(std::atoi(argv[4])) : 0);
+        }
+        if (mode == "--shm-quote" && (argc == 3 || argc == 4)) {
+            return runShmQuoteMode(tables, argv[2], argc == 4 ? argv[3] : nullptr);
+        }
+        if (mode == "--bench-vehicles" && argc <= 3) {
+            return runVehicleBenchMode(tables, argc == 3 ? std::strtoul(argv[2], nullptr, 10) : 1000000);
+        }
+        if (mode == "--scaling" && (argc == 3 || argc == 4)) {
+            return runScalingMode(tables, argv[2], argc == 4 ? static_cast<unsigned>(std::atoi(argv[3])) : 0);
+        }
+        printUsage(argv[0]);
+        return (mode == "--help" || mode == "-h") ? 0 : 2;
+    }
+
+    cout << "Grab Fare Calculator (Enhanced)" << endl;
+    string promoList;
+    for (const string &code : tables.promos.codes()) promoList += (promoList.empty() ? "" : ", ") + code;
+    cout << "Promo codes available: " << promoList << endl;
+
+    bool runAgain = true;
+    while (runAgain) {
+        // Display menu
+        cout << "\nSelect vehicle type:" << endl;
+        cout << "1) GrabCar Economy" << endl;
+        cout << "2) GrabCar Premium" << endl;
+        cout << "3) GrabBike" << endl;
+
+        int vehicleChoice = readMenuChoice("Enter choice (1–3): ", 1, 3);
+        const char *vehicleName = vehicleDisplayName(vehicleChoice);
+        if (static_cast<size_t>(vehicleChoice) >= tables.ratesById.size() || !tables.vehicleKnown[vehicleChoice]) {
+            cout << vehicleName << " is not on this rate card." << endl;
+            continue;
+        }
+        Rates selectedRates = tables.ratesById[vehicleChoice];
+
+        cout << "Selected: " << vehicleName << endl;
+        cout << "Base fare: RM " << selectedRates.base
+             << ", Per km: RM " << selectedRates.perKm
+             << ", Booking fee: RM " << selectedRates.bookingFee;
+        if (selectedRates.perMin > 0) {
+            cout << ", Per minute: RM " << selectedRates.perMin;
+        }
+        cout << endl;
+
+        // Read trip details
+        double distanceKm;
+        if (!readPositiveDouble("Enter trip distance (km): ", distanceKm, 200.0)) {
+            cout << "Input ended unexpectedly. Exiting." << endl;
+            return 0;
+        }
+        double timeMin = 0;
+        if (selectedRates.perMin > 0) {
+            if (!readPositiveDouble("Enter estimated time (minutes): ", timeMin, 1000.0)) {
+                cout << "Input ended unexpectedly. Exiting." << endl;
+                return 0;
+            }
+        }
+
+        // Determine peak or off-peak
+        int peakChoice = readMenuChoice("Is this a peak‑hour ride? 1) No  2) Yes : ", 1, 2);
+        bool isPeak = (peakChoice == 2);
+
+        // Ask for promo code
+        cout << "Enter promo code (or NONE): ";
+        string promoInput;
+        cin >> promoInput;
+
+        // Compute fare
+        FareBreakdown fb = computeFare(distanceKm, timeMin, isPeak,
+                                      promoInput, selectedRates,
+                                      tables.peakMultiplier, tables.minFare,
+                                      tables.promos);
+
+        // Print summary and breakdown with one write, after anything
+        // still buffered in cout
+        TextBuffer receipt;
+        appendTripSummary(receipt, vehicleName, isPeak, distanceKm, timeMin, selectedRates.perMin > 0);
+        appendBreakdown(receipt, fb, tables.promos);
+        cout.flush();
+        receipt.writeTo(STDOUT_FILENO);
+        // The rate line of later rounds has always been printed in this format
+        cout << std::fixed << std::setprecision(2);
 
         // Ask if user wants another calculation
         int again = readMenuChoice("Would you like to calculate another fare? 1) Yes  2) No : ", 1, 2);